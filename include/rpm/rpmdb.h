@@ -36,7 +36,8 @@ typedef enum rpmdbCtrlOp_e {
     RPMDB_CTRL_UNLOCK_RO       = 2,
     RPMDB_CTRL_LOCK_RW         = 3,
     RPMDB_CTRL_UNLOCK_RW       = 4,
-    RPMDB_CTRL_INDEXSYNC       = 5
+    RPMDB_CTRL_INDEXSYNC       = 5,
+    RPMDB_CTRL_COMPACT         = 6
 } rpmdbCtrlOp;
 
 /** \ingroup rpmdb
@@ -149,6 +150,42 @@ rpmdbMatchIterator rpmdbInitIterator(rpmdb db, rpmDbiTagVal rpmtag,
  */
 Header rpmdbNextIterator(rpmdbMatchIterator mi);
 
+/** \ingroup rpmdb
+ * Package callback of rpmdbForeachIterator(), called from worker threads.
+ * It must not access the database or other unprotected shared state.
+ * @param h		package header
+ * @param data		caller private data
+ * @param[out] result	result to pass on to the emit callback (if any)
+ * @return		0 on success
+ */
+typedef int (*rpmdbForeachFunc)(Header h, void *data, void **result);
+
+/** \ingroup rpmdb
+ * Result callback of rpmdbForeachIterator(), called from the calling
+ * thread in iteration order.
+ * @param h		package header
+ * @param result	result from the package callback
+ * @param data		caller private data
+ * @return		0 on success
+ */
+typedef int (*rpmdbEmitFunc)(Header h, void *result, void *data);
+
+/** \ingroup rpmdb
+ * Process the remaining headers of an iteration on multiple threads.
+ * Headers are retrieved by the calling thread and passed to func in
+ * batches on up to nthreads threads. If emit is set, it's called for
+ * each header in iteration order as batches complete.
+ * @param mi		rpm database iterator
+ * @param nthreads	max. number of threads (<= 1 to disable)
+ * @param func		package callback
+ * @param emit		result callback (or NULL)
+ * @param data		caller private data
+ * @return		0 on success, last non-zero callback return otherwise
+ */
+int rpmdbForeachIterator(rpmdbMatchIterator mi, int nthreads,
+			 rpmdbForeachFunc func, rpmdbEmitFunc emit,
+			 void *data);
+
 /** \ingroup rpmdb
  * Destroy rpm database iterator.
  * @param mi		rpm database iterator
@@ -191,7 +191,8 @@ typedef	enum rpmtsOpX_e {
     RPMTS_OP_DBPUT		= 15,
     RPMTS_OP_DBDEL		= 16,
     RPMTS_OP_VERIFY		= 17,
-    RPMTS_OP_MAX		= 18
+    RPMTS_OP_SYNC		= 18,
+    RPMTS_OP_MAX		= 19
 } rpmtsOpX;
 
 enum rpmtxnFlags_e {
@@ -339,6 +340,14 @@ int rpmtsParkDB(rpmts ts);
  */
 int rpmtsVerifyDB(rpmts ts);
 
+/** \ingroup rpmts
+ * Compact the database used by the transaction, releasing the space
+ * left behind by erased packages.
+ * @param ts		transaction set
+ * @return		0 on success
+ */
+int rpmtsCompactDB(rpmts ts);
+
 /** \ingroup rpmts
  * Return transaction database iterator.
  * @param ts		transaction set
@@ -644,6 +653,16 @@ rpm_color_t rpmtsSetPrefColor(rpmts ts, rpm_color_t color);
  */
 rpmop rpmtsOp(rpmts ts, rpmtsOpX opx);
 
+/** \ingroup rpmts
+ * Return a JSON formatted timing profile of the transaction set. The
+ * profile contains the transaction wide operation timings, and for each
+ * element its verify, unpack/erase, scriptlet, trigger, rpmdb and sync
+ * timings along with the individual scriptlets run.
+ * @param ts		transaction set
+ * @return		profile as JSON (malloced)
+ */
+char * rpmtsProfile(rpmts ts);
+
 /** \ingroup rpmts
  * Get the plugins associated with a transaction set
  * @param ts		transaction set
@@ -703,6 +703,27 @@ static rpmRC bdbro_idxdbDel(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum,
     return RPMRC_FAIL;
 }
 
+static rpmRC bdbro_idxdbPutSet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen, dbiIndexSet set)
+{
+    return RPMRC_FAIL;
+}
+
+static unsigned char * bdbro_pkgdbTake(dbiIndex dbi, dbiCursor dbc, unsigned char *hdrBlob)
+{
+    return NULL;
+}
+
+/* No summary store, callers use the full header */
+static rpmRC bdbro_sumdbGet(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum, unsigned char **sumBlob, unsigned int *sumLen)
+{
+    return RPMRC_NOTFOUND;
+}
+
+static rpmRC bdbro_sumdbPut(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum, unsigned char *sumBlob, unsigned int sumLen)
+{
+    return RPMRC_FAIL;
+}
+
 static rpmRC bdbro_idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen,
                           dbiIndexSet *set, int searchType)
 {
@@ -728,7 +749,13 @@ static rpmRC bdbro_idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_
 	cur->key.kv = 0;
 	return r == -1 ? RPMRC_FAIL : rc;
     }
-    if (keyp) {
+    if (searchType & DBC_PREFIX_ITER) {
+	/* no ordered key walk over all pages, filter the full iteration */
+	while ((r = cur_next(cur)) == 0) {
+	    if (cur->key.len >= keylen && memcmp(cur->key.kv, keyp, keylen) == 0)
+		break;
+	}
+    } else if (keyp) {
 	if (keylen == 0) {
 	    keyp = "";
 	    keylen = 1;
@@ -823,6 +850,10 @@ struct rpmdbOps_s bdbro_dbops = {
     .idxdbGet   = bdbro_idxdbGet,
     .idxdbPut   = bdbro_idxdbPut,
     .idxdbDel   = bdbro_idxdbDel,
-    .idxdbKey   = bdbro_idxdbKey
+    .idxdbKey   = bdbro_idxdbKey,
+    .idxdbPutSet = bdbro_idxdbPutSet,
+    .pkgdbTake	= bdbro_pkgdbTake,
+    .sumdbGet	= bdbro_sumdbGet,
+    .sumdbPut	= bdbro_sumdbPut
 };
 
@@ -215,6 +215,21 @@ unsigned int pkgdbKey(dbiIndex dbi, dbiCursor dbc)
     return dbi->dbi_rpmdb->db_ops->pkgdbKey(dbi, dbc);
 }
 
+unsigned char * pkgdbTake(dbiIndex dbi, dbiCursor dbc, unsigned char *hdrBlob)
+{
+    return dbi->dbi_rpmdb->db_ops->pkgdbTake(dbi, dbc, hdrBlob);
+}
+
+rpmRC sumdbGet(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum, unsigned char **sumBlob, unsigned int *sumLen)
+{
+    return dbi->dbi_rpmdb->db_ops->sumdbGet(dbi, dbc, hdrNum, sumBlob, sumLen);
+}
+
+rpmRC sumdbPut(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum, unsigned char *sumBlob, unsigned int sumLen)
+{
+    return dbi->dbi_rpmdb->db_ops->sumdbPut(dbi, dbc, hdrNum, sumBlob, sumLen);
+}
+
 rpmRC idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen, dbiIndexSet *set, int curFlags)
 {
     return dbi->dbi_rpmdb->db_ops->idxdbGet(dbi, dbc, keyp, keylen, set, curFlags);
@@ -235,3 +250,9 @@ const void * idxdbKey(dbiIndex dbi, dbiCursor dbc, unsigned int *keylen)
     return dbi->dbi_rpmdb->db_ops->idxdbKey(dbi, dbc, keylen);
 }
 
+rpmRC idxdbPutSet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen,
+		  dbiIndexSet set)
+{
+    return dbi->dbi_rpmdb->db_ops->idxdbPutSet(dbi, dbc, keyp, keylen, set);
+}
+
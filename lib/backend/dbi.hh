@@ -1,7 +1,9 @@
 #ifndef _DBI_H
 #define _DBI_H
 
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <stdio.h>
 #include <atomic>
@@ -25,7 +27,10 @@ typedef enum dbCtrlOp_e {
     DB_CTRL_UNLOCK_RO		= 2,
     DB_CTRL_LOCK_RW		= 3,
     DB_CTRL_UNLOCK_RW		= 4,
-    DB_CTRL_INDEXSYNC		= 5
+    DB_CTRL_INDEXSYNC		= 5,
+    DB_CTRL_SNAPSHOT_BEGIN	= 6,
+    DB_CTRL_SNAPSHOT_END	= 7,
+    DB_CTRL_COMPACT		= 8
 } dbCtrlOp;
 
 struct dbiCursor_s {
@@ -40,6 +45,17 @@ struct dbConfig_s {
 
 using dbChk = std::unordered_map<unsigned int,rpmRC>;
 
+/*
+ * Persistent headerCheck() success: header blob digest, vsflags used
+ * and digest of the keyring the check was done against
+ */
+struct dbVerified_s {
+    std::string digest;
+    unsigned int vsflags;
+    std::string keyring;
+};
+using dbVerified = std::unordered_map<unsigned int,dbVerified_s>;
+
 struct rpmdbOps_s;
 
 /** \ingroup rpmdb
@@ -54,6 +70,8 @@ struct rpmdb_s {
     int		db_perms;	/*!< open permissions */
     const char	* db_descr;	/*!< db backend description (for error msgs) */
     dbChk	db_checked;	/*!< headerCheck()'ed package instances */
+    dbVerified	db_verified;	/*!< Persistent headerCheck() cache */
+    int		db_hdrcache;	/*!< Cache enabled (1) or modified (2)? */
     rpmdb	db_next;
     int		db_opens;
     dbiIndex	db_pkgs;	/*!< Package db */
@@ -61,6 +79,10 @@ struct rpmdb_s {
     int		db_ndbi;	/*!< No. of tag indices. */
     dbiIndex 	* db_indexes;	/*!< Tag indices. */
     int		db_buildindex;	/*!< Index rebuild indicator */
+    int		db_snapshot;	/*!< Snapshot reads enabled? */
+    int		db_snapshots;	/*!< No. of iterators in the snapshot */
+    int		db_summary;	/*!< Package summaries enabled? */
+    std::vector<rpmTagVal> db_sumtags;	/*!< Extra tags in summaries */
 
     const struct rpmdbOps_s * db_ops;	/*!< backend ops */
 
@@ -86,6 +108,8 @@ enum dbiFlags_e {
     DBI_NONE		= 0,
     DBI_CREATED		= (1 << 0),
     DBI_RDONLY		= (1 << 1),
+    DBI_SUMMARY		= (1 << 2),
+    DBI_SUMMARY_CREATED	= (1 << 3),
 };
 
 enum dbcFlags_e {
@@ -96,6 +120,7 @@ enum dbcFlags_e {
 enum dbcSearchType_e {
     DBC_NORMAL_SEARCH   = 0,
     DBC_PREFIX_SEARCH   = (1 << 0),
+    DBC_PREFIX_ITER     = (1 << 1),	/* iterate keys starting with keyp */
 };
 
 /** \ingroup dbi
@@ -117,6 +142,11 @@ RPM_GNUC_INTERNAL
 rpmRC tag2index(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h,
 		idxfunc idxupdate);
 
+/* As tag2index(), but passing the keys through the caller's cursor */
+RPM_GNUC_INTERNAL
+rpmRC tag2keys(dbiIndex dbi, dbiCursor dbc, rpmTagVal rpmtag,
+		unsigned int hdrNum, Header h, idxfunc idxupdate);
+
 RPM_GNUC_INTERNAL
 /* Globally enable/disable fsync in the backend */
 void dbSetFSync(rpmdb rdb, int enable);
@@ -218,6 +248,47 @@ rpmRC pkgdbGet(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum,
 RPM_GNUC_INTERNAL
 unsigned int pkgdbKey(dbiIndex dbi, dbiCursor dbc);
 
+/** \ingroup dbi
+ * Take over the blob last returned by pkgdbGet() on a cursor.
+ * @param dbi		index database handle
+ * @param dbc		index database cursor
+ * @param hdrBlob	header blob returned by pkgdbGet()
+ * @return		malloc'ed blob now owned by the caller, NULL if
+ *			the backend cannot hand it over (copy it instead)
+ */
+RPM_GNUC_INTERNAL
+unsigned char * pkgdbTake(dbiIndex dbi, dbiCursor dbc, unsigned char *hdrBlob);
+
+/** \ingroup dbi
+ * Retrieve a package summary (a header blob with a subset of tags).
+ * When iterating (hdrNum 0), packages without a summary are returned
+ * with a NULL blob, use pkgdbKey() for the header instance.
+ * @param dbi		index database handle
+ * @param dbc		index database cursor
+ * @param hdrNum	header instance or 0 to iterate
+ * @param[out] sumBlob	summary blob
+ * @param[out] sumLen	summary blob length
+ * @return		RPMRC_OK on success, RPMRC_NOTFOUND if no summary
+ *			(or end of iteration)
+ */
+RPM_GNUC_INTERNAL
+rpmRC sumdbGet(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum,
+	       unsigned char **sumBlob, unsigned int *sumLen);
+
+/** \ingroup dbi
+ * Store a package summary. Summaries are dropped by the backend when
+ * the package is removed or its header rewritten.
+ * @param dbi		index database handle
+ * @param dbc		index database cursor
+ * @param hdrNum	header instance
+ * @param sumBlob	summary blob
+ * @param sumLen	summary blob length
+ * @return		RPMRC_OK on success
+ */
+RPM_GNUC_INTERNAL
+rpmRC sumdbPut(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum,
+	       unsigned char *sumBlob, unsigned int sumLen);
+
 RPM_GNUC_INTERNAL
 rpmRC idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen,
                dbiIndexSet *set, int curFlags);
@@ -230,6 +301,10 @@ rpmRC idxdbDel(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h);
 RPM_GNUC_INTERNAL
 const void * idxdbKey(dbiIndex dbi, dbiCursor dbc, unsigned int *keylen);
 
+RPM_GNUC_INTERNAL
+rpmRC idxdbPutSet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen,
+		  dbiIndexSet set);
+
 struct rpmdbOps_s {
     const char *name; /* backend name */
     const char *path; /* main database name */
@@ -252,6 +327,10 @@ struct rpmdbOps_s {
     rpmRC (*idxdbPut)(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h);
     rpmRC (*idxdbDel)(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h);
     const void * (*idxdbKey)(dbiIndex dbi, dbiCursor dbc, unsigned int *keylen);
+    rpmRC (*idxdbPutSet)(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen, dbiIndexSet set);
+    unsigned char * (*pkgdbTake)(dbiIndex dbi, dbiCursor dbc, unsigned char *hdrBlob);
+    rpmRC (*sumdbGet)(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum, unsigned char **sumBlob, unsigned int *sumLen);
+    rpmRC (*sumdbPut)(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum, unsigned char *sumBlob, unsigned int sumLen);
 };
 
 #if defined(ENABLE_BDB_RO)
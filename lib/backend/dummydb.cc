@@ -85,6 +85,26 @@ static const void * dummydb_idxdbKey(dbiIndex dbi, dbiCursor dbc, unsigned int *
     return NULL;
 }
 
+static rpmRC dummydb_idxdbPutSet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen, dbiIndexSet set)
+{
+    return RPMRC_FAIL;
+}
+
+static unsigned char * dummydb_pkgdbTake(dbiIndex dbi, dbiCursor dbc, unsigned char *hdrBlob)
+{
+    return NULL;
+}
+
+static rpmRC dummydb_sumdbGet(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum, unsigned char **sumBlob, unsigned int *sumLen)
+{
+    return RPMRC_NOTFOUND;
+}
+
+static rpmRC dummydb_sumdbPut(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum, unsigned char *sumBlob, unsigned int sumLen)
+{
+    return RPMRC_FAIL;
+}
+
 
 
 struct rpmdbOps_s dummydb_dbops = {
@@ -108,6 +128,10 @@ struct rpmdbOps_s dummydb_dbops = {
     .idxdbGet	= dummydb_idxdbGet,
     .idxdbPut	= dummydb_idxdbPut,
     .idxdbDel	= dummydb_idxdbDel,
-    .idxdbKey	= dummydb_idxdbKey
+    .idxdbKey	= dummydb_idxdbKey,
+    .idxdbPutSet = dummydb_idxdbPutSet,
+    .pkgdbTake	= dummydb_pkgdbTake,
+    .sumdbGet	= dummydb_sumdbGet,
+    .sumdbPut	= dummydb_sumdbPut
 };
 
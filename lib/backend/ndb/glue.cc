@@ -32,6 +32,8 @@ struct ndbEnv_s {
     rpmxdb xdb;
     int refs;
     int dofsync;
+    int snapshot;
+    unsigned int snapidx;	/* next package index at snapshot start */
 
     unsigned int hdrNum;
     void *data;
@@ -247,6 +249,25 @@ static int indexSync(rpmpkgdb pkgdb, rpmxdb xdb)
     return rc;
 }
 
+static int ndbCompact(struct ndbEnv_s *ndbenv)
+{
+    unsigned int nmoved, total = 0;
+
+    if (!ndbenv->pkgdb || !ndbenv->xdb)
+	return 1;
+    /* moves bump the generation, keep the indexes in sync after every
+     * chunk so that they do not get rebuilt on the next open */
+    do {
+	if (rpmpkgCompact(ndbenv->pkgdb, 64, &nmoved))
+	    return 1;
+	if (indexSync(ndbenv->pkgdb, ndbenv->xdb))
+	    return 1;
+	total += nmoved;
+    } while (nmoved);
+    rpmlog(RPMLOG_DEBUG, "compacted db            moved %u packages\n", total);
+    return 0;
+}
+
 static int ndb_Ctrl(rpmdb rdb, dbCtrlOp ctrl)
 {
     struct ndbEnv_s *ndbenv = (struct ndbEnv_s *)rdb->db_dbenv;
@@ -272,6 +293,22 @@ static int ndb_Ctrl(rpmdb rdb, dbCtrlOp ctrl)
 	if (!ndbenv)
 	    return 1;
 	return indexSync(ndbenv->pkgdb, ndbenv->xdb);
+    case DB_CTRL_SNAPSHOT_BEGIN:
+	if (!ndbenv || !ndbenv->pkgdb)
+	    return 1;
+	if (rpmpkgPeekNextPkgIdx(ndbenv->pkgdb, &ndbenv->snapidx))
+	    return 1;
+	ndbenv->snapshot = 1;
+	return 0;
+    case DB_CTRL_SNAPSHOT_END:
+	if (!ndbenv)
+	    return 1;
+	ndbenv->snapshot = 0;
+	return 0;
+    case DB_CTRL_COMPACT:
+	if (!ndbenv)
+	    return 1;
+	return ndbCompact(ndbenv);
     default:
 	break;
     }
@@ -355,6 +392,17 @@ static rpmRC ndb_pkgdbDel(dbiIndex dbi, dbiCursor _dbc,  unsigned int hdrNum)
     return rpmpkgDel((rpmpkgdb)dbc->dbi->dbi_db, hdrNum);
 }
 
+/* Get a package blob, hiding packages added after the snapshot start */
+static rpmRC pkgGet(ndb_cursor *dbc, unsigned int hdrNum, unsigned char **hdrBlob, unsigned int *hdrLen)
+{
+    struct ndbEnv_s *ndbenv = (struct ndbEnv_s *)dbc->dbi->dbi_rpmdb->db_dbenv;
+    rpmpkgdb pkgdb = (rpmpkgdb)dbc->dbi->dbi_db;
+
+    if (ndbenv->snapshot)
+	return rpmpkgGetSnapshot(pkgdb, hdrNum, ndbenv->snapidx, hdrBlob, hdrLen);
+    return rpmpkgGet(pkgdb, hdrNum, hdrBlob, hdrLen);
+}
+
 /* iterate over all packages */
 static rpmRC ndb_pkgdbIter(dbiIndex dbi, dbiCursor _dbc, unsigned char **hdrBlob, unsigned int *hdrLen)
 {
@@ -375,7 +423,7 @@ static rpmRC ndb_pkgdbIter(dbiIndex dbi, dbiCursor _dbc, unsigned char **hdrBlob
 	}
 	*hdrBlob = 0;
 	hdrNum = dbc->list[dbc->ilist];
-	rc = rpmpkgGet((rpmpkgdb)dbc->dbi->dbi_db, hdrNum, hdrBlob, hdrLen);
+	rc = pkgGet(dbc, hdrNum, hdrBlob, hdrLen);
 	if (rc && rc != RPMRC_NOTFOUND)
 	    break;
 	dbc->ilist++;
@@ -401,7 +449,7 @@ static rpmRC ndb_pkgdbGet(dbiIndex dbi, dbiCursor _dbc, unsigned int hdrNum, uns
 	*hdrLen = ndbenv->datalen;
 	return RPMRC_OK;
     }
-    rc = rpmpkgGet((rpmpkgdb)dbc->dbi->dbi_db, hdrNum, hdrBlob, hdrLen);
+    rc = pkgGet(dbc, hdrNum, hdrBlob, hdrLen);
     if (!rc) {
 	dbc->hdrNum = hdrNum;
 	setdata(dbc, hdrNum, *hdrBlob, *hdrLen);
@@ -409,6 +457,31 @@ static rpmRC ndb_pkgdbGet(dbiIndex dbi, dbiCursor _dbc, unsigned int hdrNum, uns
     return rc;
 }
 
+/* The blob is a private allocation already, just drop it from the cache */
+static unsigned char * ndb_pkgdbTake(dbiIndex dbi, dbiCursor _dbc, unsigned char *hdrBlob)
+{
+    ndb_cursor *dbc = static_cast<ndb_cursor *>(_dbc);
+    struct ndbEnv_s *ndbenv = (struct ndbEnv_s *)dbc->dbi->dbi_rpmdb->db_dbenv;
+
+    if (hdrBlob == NULL || ndbenv->data != hdrBlob)
+	return NULL;
+    ndbenv->hdrNum = 0;
+    ndbenv->data = NULL;
+    ndbenv->datalen = 0;
+    return hdrBlob;
+}
+
+/* No summary store, callers use the full header */
+static rpmRC ndb_sumdbGet(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum, unsigned char **sumBlob, unsigned int *sumLen)
+{
+    return RPMRC_NOTFOUND;
+}
+
+static rpmRC ndb_sumdbPut(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum, unsigned char *sumBlob, unsigned int sumLen)
+{
+    return RPMRC_FAIL;
+}
+
 static unsigned int ndb_pkgdbKey(dbiIndex dbi, dbiCursor _dbc)
 {
     ndb_cursor *dbc = static_cast<ndb_cursor *>(_dbc);
@@ -433,13 +506,16 @@ static void addtoset(dbiIndexSet *set, unsigned int *pkglist, unsigned int pkgli
 }
 
 /* Iterate over all index entries */
-static rpmRC ndb_idxdbIter(dbiIndex dbi, dbiCursor _dbc, dbiIndexSet *set)
+static rpmRC ndb_idxdbIter(dbiIndex dbi, dbiCursor _dbc, const char *pfx, size_t pfxlen, dbiIndexSet *set)
 {
     ndb_cursor *dbc = static_cast<ndb_cursor *>(_dbc);
     rpmRC rc;
     if (!dbc->list) {
 	/* setup iteration list on first call */
-	rc = rpmidxList((rpmidxdb)dbc->dbi->dbi_db, &dbc->list, &dbc->nlist, &dbc->listdata);
+	if (pfx)
+	    rc = rpmidxListPrefix((rpmidxdb)dbc->dbi->dbi_db, (const unsigned char *)pfx, pfxlen, &dbc->list, &dbc->nlist, &dbc->listdata);
+	else
+	    rc = rpmidxList((rpmidxdb)dbc->dbi->dbi_db, &dbc->list, &dbc->nlist, &dbc->listdata);
 	if (rc)
 	    return rc;
 	dbc->ilist = 0;
@@ -487,35 +563,13 @@ static rpmRC ndb_idxdbGet(dbiIndex dbi, dbiCursor _dbc, const char *keyp, size_t
     rpmRC rc;
     unsigned int *pkglist = 0, pkglistn = 0;
 
-    if (!keyp)
-	return ndb_idxdbIter(dbi, dbc, set);
+    if (!keyp || (searchType & DBC_PREFIX_ITER))
+	return ndb_idxdbIter(dbi, dbc, keyp, keylen, set);
 
-    if (searchType == DBC_PREFIX_SEARCH) {
-	unsigned int *list = 0, nlist = 0, i = 0;
-	unsigned char *listdata = 0;
-	rpmRC rrc = RPMRC_NOTFOUND;
-	rc = rpmidxList((rpmidxdb)dbc->dbi->dbi_db, &list, &nlist, &listdata);
-	if (rc)
-	    return rc;
-	for (i = 0; i < nlist && !rc; i += 2) {
-	    unsigned char *k = listdata + list[i];
-	    unsigned int kl = list[i + 1];
-	    if (kl < keylen || memcmp(k, keyp, keylen) != 0)
-		continue;
-	    rc = ndb_idxdbGet(dbi, dbc, (char *)k, kl, set, DBC_NORMAL_SEARCH);
-	    if (rc == RPMRC_NOTFOUND)
-		rc = RPMRC_OK;
-	    else
-		rrc = rc;
-	}
-	if (list)
-	    free(list);
-	if (listdata)
-	    free(listdata);
-	return rc ? rc : rrc;
-    }
-
-    rc = rpmidxGet((rpmidxdb)dbc->dbi->dbi_db, (const unsigned char *)keyp, keylen, &pkglist, &pkglistn);
+    if (searchType == DBC_PREFIX_SEARCH)
+	rc = rpmidxGetPrefix((rpmidxdb)dbc->dbi->dbi_db, (const unsigned char *)keyp, keylen, &pkglist, &pkglistn);
+    else
+	rc = rpmidxGet((rpmidxdb)dbc->dbi->dbi_db, (const unsigned char *)keyp, keylen, &pkglist, &pkglistn);
     if (!rc)
 	addtoset(set, pkglist, pkglistn);
     return rc;
@@ -532,6 +586,22 @@ static rpmRC ndb_idxdbPut(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, H
     return tag2index(dbi, rpmtag, hdrNum, h, ndb_idxdbPutOne);
 }
 
+static rpmRC ndb_idxdbPutSet(dbiIndex dbi, dbiCursor _dbc, const char *keyp, size_t keylen, dbiIndexSet set)
+{
+    ndb_cursor *dbc = static_cast<ndb_cursor *>(_dbc);
+    unsigned int i, n = dbiIndexSetCount(set);
+    unsigned int *pkglist = (unsigned int *)xmalloc(2 * n * sizeof(*pkglist));
+    rpmRC rc;
+
+    for (i = 0; i < n; i++) {
+	pkglist[2 * i] = dbiIndexRecordOffset(set, i);
+	pkglist[2 * i + 1] = dbiIndexRecordFileNumber(set, i);
+    }
+    rc = rpmidxPutList((rpmidxdb)dbc->dbi->dbi_db, (const unsigned char *)keyp, keylen, pkglist, 2 * n);
+    free(pkglist);
+    return rc;
+}
+
 static rpmRC ndb_idxdbDelOne(dbiIndex dbi, dbiCursor _dbc, const char *keyp, size_t keylen, dbiIndexItem rec)
 {
     ndb_cursor *dbc = static_cast<ndb_cursor *>(_dbc);
@@ -574,6 +644,10 @@ struct rpmdbOps_s ndb_dbops = {
     .idxdbGet	= ndb_idxdbGet,
     .idxdbPut	= ndb_idxdbPut,
     .idxdbDel	= ndb_idxdbDel,
-    .idxdbKey	= ndb_idxdbKey
+    .idxdbKey	= ndb_idxdbKey,
+    .idxdbPutSet = ndb_idxdbPutSet,
+    .pkgdbTake	= ndb_pkgdbTake,
+    .sumdbGet	= ndb_sumdbGet,
+    .sumdbPut	= ndb_sumdbPut
 };
 
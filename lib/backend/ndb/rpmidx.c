@@ -61,6 +61,13 @@
  * Deleting a (key, data) pair is done by replacing the slot with a
  * (-1, -1, 0) dummy entry.
  *
+ * For prefix searches a second blob contains the offsets of all keys
+ * sorted by key. It is tagged with the generation of the index it is
+ * in sync with. Adding and freeing keys updates it in place, so it
+ * only needs to be re-created after an index rebuild or a write by a
+ * version that doesn't know about it. Read-only handles scan the key
+ * space instead of using an outdated blob.
+ *
  */
 
 
@@ -95,6 +102,10 @@ struct rpmidxdb_s {
     unsigned int xmask;
 
     unsigned int pagesize;
+
+    unsigned int sorted_id;	/* sorted key blob, if mapped */
+    unsigned char *sorted_mapped;
+    unsigned int sorted_size;
 };
 
 #if 0
@@ -147,6 +158,17 @@ static inline void h2lea(unsigned int x, unsigned char *p)
 
 #define IDXDB_XDB_SUBTAG		0
 #define IDXDB_XDB_SUBTAG_REBUILD	1
+#define IDXDB_XDB_SUBTAG_SORTED		2
+
+/* Sorted key blob */
+
+#define IDXDB_SORTED_MAGIC     ('R' | 'p' << 8 | 'm' << 16 | 'S' << 24)
+
+#define IDXDB_SORTED_OFFSET_MAGIC	0
+#define IDXDB_SORTED_OFFSET_GENERATION	4
+#define IDXDB_SORTED_OFFSET_NKEYS	8
+
+#define IDXDB_SORTED_KEY_OFFSET	16
 
 static void set_mapped(rpmidxdb idxdb, unsigned char *addr, unsigned int size)
 {
@@ -273,10 +295,25 @@ static inline void updateKeyexcess(rpmidxdb idxdb)
     h2lea(idxdb->keyexcess, idxdb->head_mapped + IDXDB_OFFSET_KEYEXCESS);
 }
 
+/* is the sorted key blob in sync with the given index generation? */
+static int rpmidxSortedCurrent(rpmidxdb idxdb, unsigned int generation)
+{
+    if (!idxdb->sorted_mapped || idxdb->sorted_size < IDXDB_SORTED_KEY_OFFSET)
+	return 0;
+    if (le2ha(idxdb->sorted_mapped + IDXDB_SORTED_OFFSET_MAGIC) != IDXDB_SORTED_MAGIC ||
+	    le2ha(idxdb->sorted_mapped + IDXDB_SORTED_OFFSET_GENERATION) != generation)
+	return 0;
+    return le2ha(idxdb->sorted_mapped + IDXDB_SORTED_OFFSET_NKEYS) <= (idxdb->sorted_size - IDXDB_SORTED_KEY_OFFSET) / 4;
+}
+
 static inline void bumpGeneration(rpmidxdb idxdb)
 {
+    int sorted = rpmidxSortedCurrent(idxdb, idxdb->generation);
     idxdb->generation++;
     h2lea(idxdb->generation, idxdb->head_mapped + IDXDB_OFFSET_GENERATION);
+    /* the key order did not change (or was updated already) */
+    if (sorted)
+	h2lea(idxdb->generation, idxdb->sorted_mapped + IDXDB_SORTED_OFFSET_GENERATION);
 }
 
 /*** Key management ***/
@@ -612,6 +649,8 @@ static int rpmidxCheck(rpmidxdb idxdb)
     return RPMRC_OK;
 }
 
+static void rpmidxSortedUpdate(rpmidxdb idxdb, unsigned int keyoff, int add);
+
 static int rpmidxPutInternal(rpmidxdb idxdb, const unsigned char *key, unsigned int keyl, unsigned int pkgidx, unsigned int datidx)
 {
     unsigned int keyh = murmurhash(key, keyl);
@@ -661,6 +700,7 @@ static int rpmidxPutInternal(rpmidxdb idxdb, const unsigned char *key, unsigned
 	/* we did not find this key. add it */
 	if (addnewkey(idxdb, key, keyl, &keyoff))
 	    return RPMRC_FAIL;
+	rpmidxSortedUpdate(idxdb, keyoff, 1);
 	keyoff |= keyh & xmask;		/* tag it with the extra bits */
 	/* re-calculate ent, addnewkey may have changed the mapping! */
 	ent = idxdb->slot_mapped + 8 * h;
@@ -742,6 +782,7 @@ static int rpmidxDelInternal(rpmidxdb idxdb, const unsigned char *key, unsigned
     if (keyoff && !otherusers) {
 	/* key is no longer in use. free it */
 	int hl = keylsize(keyl);
+	rpmidxSortedUpdate(idxdb, keyoff & ~xmask, 0);
 	memset(idxdb->key_mapped + (keyoff & ~xmask), 0, hl + keyl);
 	idxdb->keyexcess += hl + keyl;
 	updateKeyexcess(idxdb);
@@ -858,6 +899,269 @@ static int rpmidxListInternal(rpmidxdb idxdb, unsigned int **keylistp, unsigned
 }
 
 
+/*** Sorted keys ***/
+
+static void sortedmapcb(rpmxdb xdb, void *data, void *newaddr, size_t newsize) {
+    rpmidxdb idxdb = data;
+    idxdb->sorted_mapped = newaddr;
+    idxdb->sorted_size = newaddr ? (unsigned int)newsize : 0;
+}
+
+static int rpmidxSortKeys_cmp(const void *a, const void *b)
+{
+    unsigned char *ka = *(unsigned char **)a;
+    unsigned char *kb = *(unsigned char **)b;
+    unsigned int hla, hlb;
+    unsigned int kla = decodekeyl(ka, &hla);
+    unsigned int klb = decodekeyl(kb, &hlb);
+    int r = memcmp(ka + hla, kb + hlb, kla < klb ? kla : klb);
+    if (r)
+	return r;
+    return kla < klb ? -1 : kla > klb ? 1 : 0;
+}
+
+/* return the little endian offsets of all keys starting with pfx in key order */
+static int rpmidxSortKeys(rpmidxdb idxdb, const unsigned char *pfx, unsigned int pfxl, unsigned char **sortedp, unsigned int *nsortedp)
+{
+    unsigned char **keys = 0, *key, *keyendp, *sorted;
+    unsigned int i, nkeys = 0;
+
+    for (key = idxdb->key_mapped + 1, keyendp = idxdb->key_mapped + idxdb->keyend; key < keyendp; ) {
+	unsigned int hl, keyl;
+	if (!*key) {
+	    key++;
+	    continue;
+	}
+	keyl = decodekeyl(key, &hl);
+	if (key + hl + keyl > keyendp)
+	    break;
+	if (keyl >= pfxl && (!pfxl || memcmp(key + hl, pfx, pfxl) == 0)) {
+	    if ((nkeys & 255) == 0)
+		keys = xrealloc(keys, (nkeys + 256) * sizeof(*keys));
+	    keys[nkeys++] = key;
+	}
+	key += hl + keyl;
+    }
+    if (nkeys > 1)
+	qsort(keys, nkeys, sizeof(*keys), rpmidxSortKeys_cmp);
+    sorted = xmalloc(nkeys * 4 + 4);
+    for (i = 0; i < nkeys; i++)
+	h2lea(keys[i] - idxdb->key_mapped, sorted + 4 * i);
+    free(keys);
+    *sortedp = sorted;
+    *nsortedp = nkeys;
+    return RPMRC_OK;
+}
+
+/* map the sorted key blob, it stays mapped until the index is closed */
+static int rpmidxMapSorted(rpmidxdb idxdb)
+{
+    unsigned int id;
+    int rc;
+
+    if (idxdb->sorted_id) {
+	if (idxdb->sorted_mapped)
+	    return RPMRC_OK;
+	/* xdb dropped the mapping, the blob is gone or was emptied */
+	if (rpmxdbLookupBlob(idxdb->xdb, &id, idxdb->xdbtag, IDXDB_XDB_SUBTAG_SORTED, 0) == RPMRC_OK && id == idxdb->sorted_id)
+	    rpmxdbUnmapBlob(idxdb->xdb, id);
+	idxdb->sorted_id = 0;
+    }
+    rc = rpmxdbLookupBlob(idxdb->xdb, &id, idxdb->xdbtag, IDXDB_XDB_SUBTAG_SORTED, 0);
+    if (rc)
+	return rc;
+    if (rpmxdbMapBlob(idxdb->xdb, id, idxdb->rdonly ? O_RDONLY : O_RDWR, sortedmapcb, idxdb))
+	return RPMRC_FAIL;
+    idxdb->sorted_id = id;
+    return idxdb->sorted_mapped ? RPMRC_OK : RPMRC_NOTFOUND;
+}
+
+static void rpmidxUnmapSorted(rpmidxdb idxdb)
+{
+    if (idxdb->sorted_id)
+	rpmxdbUnmapBlob(idxdb->xdb, idxdb->sorted_id);
+    idxdb->sorted_id = 0;
+}
+
+/* room for nkeys keys plus some slack, in pages */
+static unsigned int rpmidxSortedSize(rpmidxdb idxdb, unsigned int nkeys)
+{
+    unsigned int size = IDXDB_SORTED_KEY_OFFSET + (nkeys + nkeys / 16) * 4;
+    return (size + idxdb->pagesize - 1) & ~(idxdb->pagesize - 1);
+}
+
+/* re-create the sorted key blob, needs the exclusive lock */
+static int rpmidxWriteSorted(rpmidxdb idxdb)
+{
+    unsigned char *sorted = 0;
+    unsigned int id, nsorted, size;
+
+    if (rpmidxSortKeys(idxdb, 0, 0, &sorted, &nsorted))
+	return RPMRC_FAIL;
+    size = rpmidxSortedSize(idxdb, nsorted);
+    if (!idxdb->sorted_id) {
+	if (rpmxdbLookupBlob(idxdb->xdb, &id, idxdb->xdbtag, IDXDB_XDB_SUBTAG_SORTED, O_CREAT) ||
+		rpmxdbResizeBlob(idxdb->xdb, id, size) ||
+		rpmxdbMapBlob(idxdb->xdb, id, O_RDWR, sortedmapcb, idxdb)) {
+	    free(sorted);
+	    return RPMRC_FAIL;
+	}
+	idxdb->sorted_id = id;
+    } else if (size > idxdb->sorted_size || size * 2 < idxdb->sorted_size) {
+	if (rpmxdbResizeBlob(idxdb->xdb, idxdb->sorted_id, size)) {
+	    free(sorted);
+	    return RPMRC_FAIL;
+	}
+    }
+    if (!idxdb->sorted_mapped || idxdb->sorted_size < IDXDB_SORTED_KEY_OFFSET + nsorted * 4) {
+	free(sorted);
+	return RPMRC_FAIL;
+    }
+    memcpy(idxdb->sorted_mapped + IDXDB_SORTED_KEY_OFFSET, sorted, nsorted * 4);
+    h2lea(IDXDB_SORTED_MAGIC, idxdb->sorted_mapped + IDXDB_SORTED_OFFSET_MAGIC);
+    h2lea(nsorted,            idxdb->sorted_mapped + IDXDB_SORTED_OFFSET_NKEYS);
+    h2lea(idxdb->generation,  idxdb->sorted_mapped + IDXDB_SORTED_OFFSET_GENERATION);
+    free(sorted);
+    return RPMRC_OK;
+}
+
+static int rpmidxSortedFind(rpmidxdb idxdb, const unsigned char *sorted, unsigned int nsorted, const unsigned char *pfx, unsigned int pfxl, unsigned int *firstp);
+
+/* insert (add) or remove the key at keyoff, needs the exclusive lock */
+static void rpmidxSortedUpdate(rpmidxdb idxdb, unsigned int keyoff, int add)
+{
+    unsigned char *sorted, *key = idxdb->key_mapped + keyoff;
+    unsigned int i, nkeys, hl, keyl;
+
+    if (!idxdb->sorted_id || !rpmidxSortedCurrent(idxdb, idxdb->generation))
+	return;
+    nkeys = le2ha(idxdb->sorted_mapped + IDXDB_SORTED_OFFSET_NKEYS);
+    keyl = decodekeyl(key, &hl);
+    sorted = idxdb->sorted_mapped + IDXDB_SORTED_KEY_OFFSET;
+    if (rpmidxSortedFind(idxdb, sorted, nkeys, key + hl, keyl, &i))
+	goto stale;
+    if (add) {
+	if (IDXDB_SORTED_KEY_OFFSET + (nkeys + 1) * 4 > idxdb->sorted_size) {
+	    if (rpmxdbResizeBlob(idxdb->xdb, idxdb->sorted_id, rpmidxSortedSize(idxdb, nkeys + 1)) || !idxdb->sorted_mapped)
+		goto stale;
+	    sorted = idxdb->sorted_mapped + IDXDB_SORTED_KEY_OFFSET;
+	}
+	memmove(sorted + 4 * (i + 1), sorted + 4 * i, 4 * (nkeys - i));
+	h2lea(keyoff, sorted + 4 * i);
+	nkeys++;
+    } else {
+	if (i >= nkeys || le2ha(sorted + 4 * i) != keyoff)
+	    goto stale;
+	memmove(sorted + 4 * i, sorted + 4 * (i + 1), 4 * (nkeys - i - 1));
+	nkeys--;
+    }
+    h2lea(nkeys, idxdb->sorted_mapped + IDXDB_SORTED_OFFSET_NKEYS);
+    return;
+
+stale:
+    /* can't keep up, let the next prefix search re-create it */
+    if (idxdb->sorted_mapped)
+	h2lea(0, idxdb->sorted_mapped + IDXDB_SORTED_OFFSET_MAGIC);
+}
+
+/* return the key at position i of the sorted list if it starts with pfx */
+static unsigned char *rpmidxSortedKey(rpmidxdb idxdb, const unsigned char *sorted, unsigned int i, const unsigned char *pfx, unsigned int pfxl, unsigned int *keylp)
+{
+    unsigned int off = le2ha((unsigned char *)sorted + 4 * i), keyl, hl;
+    unsigned char *key;
+    if (!off || off >= idxdb->keyend)
+	return 0;
+    key = idxdb->key_mapped + off;
+    keyl = decodekeyl(key, &hl);
+    if (off + hl + keyl > idxdb->keyend || keyl < pfxl || memcmp(key + hl, pfx, pfxl) != 0)
+	return 0;
+    *keylp = keyl;
+    return key + hl;
+}
+
+/* find the first key not smaller than the prefix, O(log n) */
+static int rpmidxSortedFind(rpmidxdb idxdb, const unsigned char *sorted, unsigned int nsorted, const unsigned char *pfx, unsigned int pfxl, unsigned int *firstp)
+{
+    unsigned int lo = 0, hi = nsorted, mid, off, keyl, hl;
+    unsigned char *key;
+    int r;
+
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	off = le2ha((unsigned char *)sorted + 4 * mid);
+	if (!off || off >= idxdb->keyend)
+	    return RPMRC_FAIL;
+	key = idxdb->key_mapped + off;
+	keyl = decodekeyl(key, &hl);
+	if (off + hl + keyl > idxdb->keyend)
+	    return RPMRC_FAIL;
+	r = memcmp(key + hl, pfx, keyl < pfxl ? keyl : pfxl);
+	if (r < 0 || (r == 0 && keyl < pfxl))
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    *firstp = lo;
+    return RPMRC_OK;
+}
+
+/* collect the data of all keys starting with pfx, O(log n + k) */
+static int rpmidxGetPrefixInternal(rpmidxdb idxdb, const unsigned char *sorted, unsigned int nsorted, const unsigned char *pfx, unsigned int pfxl, unsigned int **pkgidxlistp, unsigned int *pkgidxnump)
+{
+    unsigned int i, keyl;
+    unsigned int *hits = 0, nhits = 0;
+    unsigned char *key;
+
+    if (rpmidxSortedFind(idxdb, sorted, nsorted, pfx, pfxl, &i))
+	return RPMRC_FAIL;
+    for (; i < nsorted; i++) {
+	unsigned int *list = 0, nlist = 0;
+	if ((key = rpmidxSortedKey(idxdb, sorted, i, pfx, pfxl, &keyl)) == 0)
+	    break;
+	if (rpmidxGetInternal(idxdb, key, keyl, &list, &nlist) == RPMRC_OK) {
+	    hits = xrealloc(hits, (nhits + nlist) * sizeof(*hits));
+	    memcpy(hits + nhits, list, nlist * sizeof(*hits));
+	    nhits += nlist;
+	}
+	free(list);
+    }
+    *pkgidxlistp = hits;
+    *pkgidxnump = nhits;
+    return nhits ? RPMRC_OK : RPMRC_NOTFOUND;
+}
+
+/* like rpmidxListInternal, but only the keys starting with pfx in key order */
+static int rpmidxListPrefixInternal(rpmidxdb idxdb, const unsigned char *sorted, unsigned int nsorted, const unsigned char *pfx, unsigned int pfxl, unsigned int **keylistp, unsigned int *nkeylistp, unsigned char **datap)
+{
+    unsigned int i, first, keyl, datal = 0;
+    unsigned int *keylist = 0, nkeylist = 0;
+    unsigned char *data, *key;
+
+    if (rpmidxSortedFind(idxdb, sorted, nsorted, pfx, pfxl, &first))
+	return RPMRC_FAIL;
+    for (i = first; i < nsorted; i++) {
+	if ((key = rpmidxSortedKey(idxdb, sorted, i, pfx, pfxl, &keyl)) == 0)
+	    break;
+	datal += keyl + 1;
+    }
+    data = xmalloc(datal + 1);
+    keylist = xmalloc(((i - first) * 2 + 1) * sizeof(*keylist));
+    datal = 0;
+    for (i = first; i < nsorted; i++) {
+	if ((key = rpmidxSortedKey(idxdb, sorted, i, pfx, pfxl, &keyl)) == 0)
+	    break;
+	memcpy(data + datal, key, keyl);
+	data[datal + keyl] = 0;
+	keylist[nkeylist++] = datal;
+	keylist[nkeylist++] = keyl;
+	datal += keyl + 1;
+    }
+    *keylistp = keylist;
+    *nkeylistp = nkeylist;
+    *datap = data;
+    return RPMRC_OK;
+}
+
 static int rpmidxInitInternal(rpmidxdb idxdb)
 {
     unsigned int id;
@@ -965,12 +1269,15 @@ int rpmidxDelXdb(rpmpkgdb pkgdb, rpmxdb xdb, unsigned int xdbtag)
 	rpmxdbUnlock(xdb, 1);
 	return RPMRC_FAIL;
     }
+    if (rpmxdbLookupBlob(xdb, &id, xdbtag, IDXDB_XDB_SUBTAG_SORTED, 0) == RPMRC_OK)
+	rpmxdbDelBlob(xdb, id);
     rpmxdbUnlock(xdb, 1);
     return RPMRC_OK;
 }
 
 void rpmidxClose(rpmidxdb idxdb)
 {
+    rpmidxUnmapSorted(idxdb);
     rpmidxUnmap(idxdb);
     free(idxdb);
 }
@@ -983,11 +1290,30 @@ rpmRC rpmidxPut(rpmidxdb idxdb, const unsigned char *key, unsigned int keyl, uns
     }
     if (rpmidxLockReadHeader(idxdb, 1))
 	return RPMRC_FAIL;
+    rpmidxMapSorted(idxdb);
     rc = rpmidxPutInternal(idxdb, key, keyl, pkgidx, datidx);
     rpmidxUnlock(idxdb, 1);
     return rc;
 }
 
+/* put a list of pkgidx/datidx pairs for a single key with just one lock */
+rpmRC rpmidxPutList(rpmidxdb idxdb, const unsigned char *key, unsigned int keyl, const unsigned int *pkgidxlist, unsigned int pkgidxnum)
+{
+    int rc = RPMRC_OK;
+    unsigned int i;
+    for (i = 0; i < pkgidxnum; i += 2) {
+	if (!pkgidxlist[i] || pkgidxlist[i + 1] >= 0x80000000)
+	    return RPMRC_FAIL;
+    }
+    if (rpmidxLockReadHeader(idxdb, 1))
+	return RPMRC_FAIL;
+    rpmidxMapSorted(idxdb);
+    for (i = 0; i < pkgidxnum && !rc; i += 2)
+	rc = rpmidxPutInternal(idxdb, key, keyl, pkgidxlist[i], pkgidxlist[i + 1]);
+    rpmidxUnlock(idxdb, 1);
+    return rc;
+}
+
 rpmRC rpmidxDel(rpmidxdb idxdb, const unsigned char *key, unsigned int keyl, unsigned int pkgidx, unsigned int datidx)
 {
     int rc;
@@ -996,6 +1322,7 @@ rpmRC rpmidxDel(rpmidxdb idxdb, const unsigned char *key, unsigned int keyl, uns
     }
     if (rpmidxLockReadHeader(idxdb, 1))
 	return RPMRC_FAIL;
+    rpmidxMapSorted(idxdb);
     rc = rpmidxDelInternal(idxdb, key, keyl, pkgidx, datidx);
     rpmidxUnlock(idxdb, 1);
     return rc;
@@ -1025,6 +1352,76 @@ rpmRC rpmidxList(rpmidxdb idxdb, unsigned int **keylistp, unsigned int *nkeylist
     return rc;
 }
 
+/* lock and get the sorted keys, either mapped or only those matching pfx in memory (*allocp set) */
+static int rpmidxLockSorted(rpmidxdb idxdb, const unsigned char *pfx, unsigned int pfxl, unsigned char **sortedp, unsigned int *nsortedp, int *allocp, int *exclp)
+{
+    int rc = RPMRC_OK;
+
+    *exclp = 0;
+    *allocp = 0;
+    if (rpmidxLockReadHeader(idxdb, 0))
+	return RPMRC_FAIL;
+    rpmidxMapSorted(idxdb);
+    if (!rpmidxSortedCurrent(idxdb, idxdb->generation) && !idxdb->rdonly) {
+	/* outdated, re-create it so that puts and dels keep it current */
+	rpmidxUnlock(idxdb, 0);
+	if (rpmidxLockReadHeader(idxdb, 1))
+	    return RPMRC_FAIL;
+	*exclp = 1;
+	rpmidxMapSorted(idxdb);
+	if (!rpmidxSortedCurrent(idxdb, idxdb->generation))
+	    rc = rpmidxWriteSorted(idxdb);
+    }
+    if (rc == RPMRC_OK && rpmidxSortedCurrent(idxdb, idxdb->generation)) {
+	*sortedp = idxdb->sorted_mapped + IDXDB_SORTED_KEY_OFFSET;
+	*nsortedp = le2ha(idxdb->sorted_mapped + IDXDB_SORTED_OFFSET_NKEYS);
+    } else {
+	/* read-only access or no blob, scan the keys */
+	rc = rpmidxSortKeys(idxdb, pfx, pfxl, sortedp, nsortedp);
+	*allocp = 1;
+    }
+    if (rc)
+	rpmidxUnlock(idxdb, *exclp);
+    return rc;
+}
+
+static void rpmidxUnlockSorted(rpmidxdb idxdb, unsigned char *sorted, int alloc, int excl)
+{
+    if (alloc)
+	free(sorted);
+    rpmidxUnlock(idxdb, excl);
+}
+
+rpmRC rpmidxGetPrefix(rpmidxdb idxdb, const unsigned char *pfx, unsigned int pfxl, unsigned int **pkgidxlistp, unsigned int *pkgidxnump)
+{
+    unsigned char *sorted = 0;
+    unsigned int nsorted;
+    int rc, alloc, excl;
+
+    *pkgidxlistp = 0;
+    *pkgidxnump = 0;
+    if (rpmidxLockSorted(idxdb, pfx, pfxl, &sorted, &nsorted, &alloc, &excl))
+	return RPMRC_FAIL;
+    rc = rpmidxGetPrefixInternal(idxdb, sorted, nsorted, pfx, pfxl, pkgidxlistp, pkgidxnump);
+    rpmidxUnlockSorted(idxdb, sorted, alloc, excl);
+    return rc;
+}
+
+rpmRC rpmidxListPrefix(rpmidxdb idxdb, const unsigned char *pfx, unsigned int pfxl, unsigned int **keylistp, unsigned int *nkeylistp, unsigned char **datap)
+{
+    unsigned char *sorted = 0;
+    unsigned int nsorted;
+    int rc, alloc, excl;
+
+    *keylistp = 0;
+    *nkeylistp = 0;
+    if (rpmidxLockSorted(idxdb, pfx, pfxl, &sorted, &nsorted, &alloc, &excl))
+	return RPMRC_FAIL;
+    rc = rpmidxListPrefixInternal(idxdb, sorted, nsorted, pfx, pfxl, keylistp, nkeylistp, datap);
+    rpmidxUnlockSorted(idxdb, sorted, alloc, excl);
+    return rc;
+}
+
 int rpmidxStats(rpmidxdb idxdb)
 {
     if (rpmidxLockReadHeader(idxdb, 0))
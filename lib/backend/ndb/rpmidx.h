@@ -18,8 +18,11 @@ void rpmidxClose(rpmidxdb idxdbp);
 
 rpmRC rpmidxGet(rpmidxdb idxdb, const unsigned char *key, unsigned int keyl, unsigned int **pkgidxlist, unsigned int *pkgidxnum);
 rpmRC rpmidxPut(rpmidxdb idxdb, const unsigned char *key, unsigned int keyl, unsigned int pkgidx, unsigned int datidx);
+rpmRC rpmidxPutList(rpmidxdb idxdb, const unsigned char *key, unsigned int keyl, const unsigned int *pkgidxlist, unsigned int pkgidxnum);
 rpmRC rpmidxDel(rpmidxdb idxdb, const unsigned char *key, unsigned int keyl, unsigned int pkgidx, unsigned int datidx);
+rpmRC rpmidxGetPrefix(rpmidxdb idxdb, const unsigned char *pfx, unsigned int pfxl, unsigned int **pkgidxlist, unsigned int *pkgidxnum);
 rpmRC rpmidxList(rpmidxdb idxdb, unsigned int **keylistp, unsigned int *nkeylistp, unsigned char **datap);
+rpmRC rpmidxListPrefix(rpmidxdb idxdb, const unsigned char *pfx, unsigned int pfxl, unsigned int **keylistp, unsigned int *nkeylistp, unsigned char **datap);
 
 int rpmidxStats(rpmidxdb idxdb);
 
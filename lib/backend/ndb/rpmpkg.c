@@ -1242,6 +1242,62 @@ static int rpmpkgDelInternal(rpmpkgdb pkgdb, unsigned int pkgidx)
     return RPMRC_OK;
 }
 
+/* Move blobs down into the holes left by erased packages, then truncate
+ * the file. Every move is a crash-safe rpmpkgMoveBlob(), blobs only ever
+ * move towards the start so repeated calls terminate. */
+static int rpmpkgCompactInternal(rpmpkgdb pkgdb, unsigned int maxmoves, unsigned int *nmovedp)
+{
+    unsigned int i, j, nmoved = 0;
+    unsigned int lastblkend, blkoff;
+    pkgslot *slot;
+
+    if (rpmpkgReadSlots(pkgdb))
+	return RPMRC_FAIL;
+    rpmpkgOrderSlots(pkgdb);
+    lastblkend = pkgdb->slotnpages * (PAGE_SIZE / BLK_SIZE);
+    i = 0;
+    while (i < pkgdb->nslots && (!maxmoves || nmoved < maxmoves)) {
+	unsigned int hole;
+	slot = pkgdb->slots + i;
+	if (slot->blkoff < lastblkend)
+	    return RPMRC_FAIL;		/* eek, slots overlap! */
+	hole = slot->blkoff - lastblkend;
+	/* fill the hole with the last blob that fits, this may be the
+	 * blob right after the hole */
+	for (j = pkgdb->nslots; hole && j > i; j--) {
+	    if (pkgdb->slots[j - 1].blkcnt <= hole)
+		break;
+	}
+	if (!hole || j == i) {
+	    lastblkend = slot->blkoff + slot->blkcnt;
+	    i++;
+	    continue;
+	}
+	slot = pkgdb->slots + j - 1;
+	if (rpmpkgValidateZero(pkgdb, lastblkend, slot->blkcnt))
+	    return RPMRC_FAIL;
+	if (rpmpkgMoveBlob(pkgdb, slot, lastblkend))
+	    return RPMRC_FAIL;
+	nmoved++;
+	rpmpkgOrderSlots(pkgdb);
+    }
+    /* truncate the now unused end of the file */
+    if (pkgdb->nslots) {
+	slot = pkgdb->slots + pkgdb->nslots - 1;
+	blkoff = slot->blkoff + slot->blkcnt;
+    } else {
+	blkoff = pkgdb->slotnpages * (PAGE_SIZE / BLK_SIZE);
+    }
+    if (blkoff < pkgdb->fileblks) {
+	if (!rpmpkgValidateZero(pkgdb, blkoff, pkgdb->fileblks - blkoff)) {
+	    if (!ftruncate(pkgdb->fd, (off_t)blkoff * BLK_SIZE))
+		pkgdb->fileblks = blkoff;
+	}
+    }
+    *nmovedp = nmoved;
+    return RPMRC_OK;
+}
+
 static int rpmpkgListInternal(rpmpkgdb pkgdb, unsigned int **pkgidxlistp, unsigned int *npkgidxlistp)
 {
     unsigned int i, nslots, *pkgidxlist;
@@ -1296,6 +1352,18 @@ rpmRC rpmpkgGet(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned char **blobp, unsi
     return rc;
 }
 
+/* like rpmpkgGet, but packages allocated at or after nextpkgidx do not exist.
+ * Rewrites of existing packages are still visible */
+rpmRC rpmpkgGetSnapshot(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned int nextpkgidx, unsigned char **blobp, unsigned int *bloblp)
+{
+    if (pkgidx >= nextpkgidx) {
+	*blobp = 0;
+	*bloblp = 0;
+	return pkgidx ? RPMRC_NOTFOUND : RPMRC_FAIL;
+    }
+    return rpmpkgGet(pkgdb, pkgidx, blobp, bloblp);
+}
+
 rpmRC rpmpkgPut(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned char *blob, unsigned int blobl)
 {
     int rc;
@@ -1324,6 +1392,21 @@ rpmRC rpmpkgDel(rpmpkgdb pkgdb, unsigned int pkgidx)
     return rc;
 }
 
+/* Do at most maxmoves (0: unlimited) blob moves, call until nothing moves */
+rpmRC rpmpkgCompact(rpmpkgdb pkgdb, unsigned int maxmoves, unsigned int *nmovedp)
+{
+    int rc;
+
+    *nmovedp = 0;
+    if (rpmpkgLockReadHeader(pkgdb, 1))
+	return RPMRC_FAIL;
+    rc = rpmpkgCompactInternal(pkgdb, maxmoves, nmovedp);
+    free(pkgdb->slots);
+    pkgdb->slots = 0;
+    rpmpkgUnlock(pkgdb, 1);
+    return rc;
+}
+
 rpmRC rpmpkgList(rpmpkgdb pkgdb, unsigned int **pkgidxlistp, unsigned int *npkgidxlistp)
 {
     int rc;
@@ -1362,6 +1445,15 @@ rpmRC rpmpkgNextPkgIdx(rpmpkgdb pkgdb, unsigned int *pkgidxp)
     return RPMRC_OK;
 }
 
+int rpmpkgPeekNextPkgIdx(rpmpkgdb pkgdb, unsigned int *pkgidxp)
+{
+    if (rpmpkgLockReadHeader(pkgdb, 0))
+	return RPMRC_FAIL;
+    *pkgidxp = pkgdb->nextpkgidx;
+    rpmpkgUnlock(pkgdb, 0);
+    return RPMRC_OK;
+}
+
 int rpmpkgGeneration(rpmpkgdb pkgdb, unsigned int *generationp)
 {
     if (rpmpkgLockReadHeader(pkgdb, 0))
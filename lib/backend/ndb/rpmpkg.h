@@ -18,12 +18,15 @@ int rpmpkgLock(rpmpkgdb pkgdb, int excl);
 int rpmpkgUnlock(rpmpkgdb pkgdb, int excl);
 
 rpmRC rpmpkgGet(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned char **blobp, unsigned int *bloblp);
+rpmRC rpmpkgGetSnapshot(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned int nextpkgidx, unsigned char **blobp, unsigned int *bloblp);
 rpmRC rpmpkgPut(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned char *blob, unsigned int blobl);
 rpmRC rpmpkgDel(rpmpkgdb pkgdb, unsigned int pkgidx);
 rpmRC rpmpkgList(rpmpkgdb pkgdb, unsigned int **pkgidxlistp, unsigned int *npkgidxlistp);
 rpmRC rpmpkgVerify(rpmpkgdb pkgdb);
+rpmRC rpmpkgCompact(rpmpkgdb pkgdb, unsigned int maxmoves, unsigned int *nmovedp);
 
 rpmRC rpmpkgNextPkgIdx(rpmpkgdb pkgdb, unsigned int *pkgidxp);
+int rpmpkgPeekNextPkgIdx(rpmpkgdb pkgdb, unsigned int *pkgidxp);
 int rpmpkgGeneration(rpmpkgdb pkgdb, unsigned int *generationp);
 
 int rpmpkgStats(rpmpkgdb pkgdb);
@@ -1,5 +1,9 @@
 #include "system.h"
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include <sqlite3.h>
 #include <fcntl.h>
 #include <inttypes.h>
@@ -14,9 +18,24 @@
 
 static const int sleep_ms = 50;
 
+/* Max number of idle prepared statements kept around */
+static const size_t stmtcache_max = 128;
+/* Max number of rows inserted by a single statement */
+static const size_t batch_rows = 64;
+
+/* Idle prepared statements of a database connection, by SQL text */
+typedef std::unordered_multimap<std::string,sqlite3_stmt *> sqlite_stmtcache;
+
+struct sqlite_row {
+    std::string key;
+    unsigned int hdrNum;
+    unsigned int tagNum;
+};
+
 struct sqlite_cursor : public dbiCursor_s {
     sqlite3 *sdb;
     sqlite3_stmt *stmt;
+    sqlite_stmtcache *cache;
     const char *fmt;
     int flags;
     rpmTagVal tag;
@@ -25,6 +44,9 @@ struct sqlite_cursor : public dbiCursor_s {
 
     const void *key;
     unsigned int keylen;
+
+    int batch;				/* collect index rows for inserting */
+    std::vector<sqlite_row> rows;	/* pending index rows */
 };
 
 static int sqlexec(sqlite3 *sdb, const char *fmt, ...);
@@ -45,6 +67,48 @@ static void rpm_match3(sqlite3_context *sctx, int argc, sqlite3_value **argv)
     sqlite3_result_int(sctx, match);
 }
 
+static sqlite3_stmt *stmtGet(sqlite_stmtcache *cache, sqlite3 *sdb,
+			     const char *cmd)
+{
+    sqlite3_stmt *stmt = NULL;
+    auto it = cache->find(cmd);
+
+    if (it != cache->end()) {
+	stmt = it->second;
+	cache->erase(it);
+    } else {
+	sqlite3_prepare_v3(sdb, cmd, -1, SQLITE_PREPARE_PERSISTENT,
+			   &stmt, NULL);
+    }
+    return stmt;
+}
+
+static void stmtPut(sqlite_stmtcache *cache, sqlite3_stmt *stmt)
+{
+    if (stmt == NULL)
+	return;
+
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    /* Make room by dropping an arbitrary statement */
+    if (cache->size() >= stmtcache_max) {
+	auto it = cache->begin();
+	sqlite3_finalize(it->second);
+	cache->erase(it);
+    }
+    cache->insert({sqlite3_sql(stmt), stmt});
+}
+
+static void stmtCacheFree(sqlite_stmtcache *cache)
+{
+    if (cache) {
+	for (auto & entry : *cache)
+	    sqlite3_finalize(entry.second);
+	delete cache;
+    }
+}
+
 static int dbiCursorReset(sqlite_cursor *dbc)
 {
     if (dbc->stmt) {
@@ -75,8 +139,11 @@ static rpmRC dbiCursorPrep(sqlite_cursor *dbc, const char *fmt, ...)
 	cmd = sqlite3_vmprintf(fmt, ap);
 	va_end(ap);
 
-	sqlite3_prepare_v2(dbc->sdb, cmd, -1, &dbc->stmt, NULL);
+	dbc->stmt = stmtGet(dbc->cache, dbc->sdb, cmd);
 	sqlite3_free(cmd);
+	/* A cached statement doesn't update the connection error state */
+	if (dbc->stmt)
+	    return RPMRC_OK;
     } else {
 	dbiCursorReset(dbc);
     }
@@ -166,6 +233,8 @@ static int sqlite_init(rpmdb rdb, const char * dbhome)
 	sqlite3_busy_timeout(sdb, 10000);
 
 	sqlexec(sdb, "PRAGMA secure_delete = OFF");
+	/* Read header blobs straight from the mapped file */
+	sqlexec(sdb, "PRAGMA mmap_size = %d", 256 * 1024 * 1024);
 
 	if (sqlite3_db_readonly(sdb, NULL) == 0) {
 	    if (sqlexec(sdb, "PRAGMA journal_mode = WAL") == 0) {
@@ -178,6 +247,7 @@ static int sqlite_init(rpmdb rdb, const char * dbhome)
 	}
 
 	rdb->db_dbenv = sdb;
+	rdb->db_cache = new sqlite_stmtcache;
     }
     rdb->db_opens++;
 
@@ -209,6 +279,9 @@ static int sqlite_fini(rpmdb rdb)
 	if (rdb->db_opens > 1) {
 	    rdb->db_opens--;
 	} else {
+	    stmtCacheFree((sqlite_stmtcache *)rdb->db_cache);
+	    rdb->db_cache = NULL;
+
 	    if (sqlite3_db_readonly(sdb, NULL) == 0) {
 
 		sqlexec(sdb, "PRAGMA optimize");
@@ -342,6 +415,85 @@ static int init_index(dbiIndex dbi, rpmTagVal tag)
     return rc;
 }
 
+static int summary_tags(sqlite3 *sdb, std::vector<rpmTagVal> & tags)
+{
+    sqlite3_stmt *s = NULL;
+    int rc = sqlite3_prepare_v2(sdb, "SELECT tag FROM 'SummaryTags' ORDER BY tag",
+				-1, &s, NULL);
+    if (rc == SQLITE_OK) {
+	while ((rc = sqlite3_step(s)) == SQLITE_ROW)
+	    tags.push_back(sqlite3_column_int(s, 0));
+	sqlite3_finalize(s);
+    }
+    return (rc == SQLITE_DONE) ? 0 : -1;
+}
+
+/*
+ * Package summaries live in a separate table, keyed by the header instance.
+ * Triggers drop the summary whenever the package is removed or rewritten,
+ * so the table stays consistent even with rpm versions that don't know
+ * about it. Summaries are (re)created when the configured tags change.
+ */
+static int init_summary(dbiIndex dbi)
+{
+    rpmdb rdb = dbi->dbi_rpmdb;
+    sqlite3 *sdb = (sqlite3 *)dbi->dbi_db;
+    std::vector<rpmTagVal> tags;
+    int rc = 0;
+
+    if (!rdb->db_summary)
+	return 0;
+
+    if (summary_tags(sdb, tags) == 0) {
+	if (sqlite3_db_readonly(sdb, NULL) == 1 || tags == rdb->db_sumtags) {
+	    rdb->db_sumtags = tags;
+	    dbi->dbi_flags |= DBI_SUMMARY;
+	    return 0;
+	}
+    }
+
+    if (sqlite3_db_readonly(sdb, NULL) == 1)
+	return 0;
+
+    rc = sqlexec(sdb, "SAVEPOINT 'summary'");
+    if (!rc)
+	rc = sqlexec(sdb, "DROP TABLE IF EXISTS 'Summary'");
+    if (!rc)
+	rc = sqlexec(sdb, "DROP TABLE IF EXISTS 'SummaryTags'");
+    if (!rc)
+	rc = sqlexec(sdb, "CREATE TABLE 'Summary' ("
+			    "hnum INTEGER PRIMARY KEY,"
+			    "blob BLOB NOT NULL"
+			")");
+    if (!rc)
+	rc = sqlexec(sdb, "CREATE TABLE 'SummaryTags' ("
+			    "tag INTEGER PRIMARY KEY"
+			")");
+    for (auto tag : rdb->db_sumtags) {
+	if (!rc)
+	    rc = sqlexec(sdb, "INSERT INTO 'SummaryTags' VALUES(%d)", tag);
+    }
+    if (!rc)
+	rc = sqlexec(sdb, "CREATE TRIGGER IF NOT EXISTS 'Summary_del' "
+			    "AFTER DELETE ON '%q' BEGIN "
+			    "DELETE FROM 'Summary' WHERE hnum=old.hnum; END",
+			dbi->dbi_file);
+    if (!rc)
+	rc = sqlexec(sdb, "CREATE TRIGGER IF NOT EXISTS 'Summary_put' "
+			    "AFTER INSERT ON '%q' BEGIN "
+			    "DELETE FROM 'Summary' WHERE hnum=new.hnum; END",
+			dbi->dbi_file);
+    if (!rc) {
+	rc = sqlexec(sdb, "RELEASE 'summary'");
+	dbi->dbi_flags |= (DBI_SUMMARY | DBI_SUMMARY_CREATED);
+    } else {
+	sqlexec(sdb, "ROLLBACK TO 'summary'");
+	sqlexec(sdb, "RELEASE 'summary'");
+    }
+
+    return rc;
+}
+
 static int sqlite_Open(rpmdb rdb, rpmDbiTagVal rpmtag, dbiIndex * dbip, int flags)
 {
     int rc = sqlite_init(rdb, rpmdbHome(rdb));
@@ -355,6 +507,9 @@ static int sqlite_Open(rpmdb rdb, rpmDbiTagVal rpmtag, dbiIndex * dbip, int flag
 	if (!rc && !(rdb->db_flags & RPMDB_FLAG_REBUILD))
 	    rc = init_index(dbi, rpmtag);
 
+	if (!rc && dbi->dbi_type == DBI_PRIMARY)
+	    rc = init_summary(dbi);
+
 	if (!rc && dbip)
 	    *dbip = dbi;
 	else
@@ -439,6 +594,16 @@ static int sqlite_Ctrl(rpmdb rdb, dbCtrlOp ctrl)
     case DB_CTRL_UNLOCK_RW:
 	rc = sqlexec((sqlite3 *)rdb->db_dbenv, "RELEASE 'rwlock'");
 	break;
+    case DB_CTRL_SNAPSHOT_BEGIN:
+	/* In WAL mode the read transaction sees the db as of its 1st read */
+	rc = sqlexec((sqlite3 *)rdb->db_dbenv, "SAVEPOINT 'snapshot'");
+	break;
+    case DB_CTRL_SNAPSHOT_END:
+	rc = sqlexec((sqlite3 *)rdb->db_dbenv, "RELEASE 'snapshot'");
+	break;
+    case DB_CTRL_COMPACT:
+	rc = sqlexec((sqlite3 *)rdb->db_dbenv, "VACUUM");
+	break;
     default:
 	break;
     }
@@ -450,6 +615,7 @@ static sqlite_cursor *sqlite_cursor_init(dbiIndex dbi, unsigned int flags)
 {
     sqlite_cursor *dbc = new sqlite_cursor {};
     dbc->sdb = (sqlite3 *)dbi->dbi_db;
+    dbc->cache = (sqlite_stmtcache *)dbi->dbi_rpmdb->db_cache;
     dbc->flags = flags;
     dbc->tag = rpmTagGetValue(dbi->dbi_file);
     if (rpmTagGetClass(dbc->tag) == RPM_STRING_CLASS) {
@@ -465,7 +631,7 @@ static sqlite_cursor *sqlite_cursor_init(dbiIndex dbi, unsigned int flags)
 static sqlite_cursor *sqlite_cursor_free(dbiIndex dbi, sqlite_cursor *dbc)
 {
     if (dbc) {
-	sqlite3_finalize(dbc->stmt);
+	stmtPut(dbc->cache, dbc->stmt);
 	if (dbc->subc)
 	    sqlite_cursor_free(dbi, dbc->subc);
 	if (dbc->flags & DBC_WRITE)
@@ -644,14 +810,57 @@ static rpmRC sqlite_idxdbByKey(dbiIndex dbi, dbiCursor _dbc,
     return rc;
 }
 
-static rpmRC sqlite_idxdbIter(dbiIndex dbi, dbiCursor _dbc, dbiIndexSet *set)
+static int dbiCursorBindKey(sqlite_cursor *dbc, int col,
+			    const char *key, int keylen, sqlite3_destructor_type d)
+{
+    if (dbc->ctype == SQLITE_TEXT)
+	return sqlite3_bind_text(dbc->stmt, col, key, keylen, d);
+    return sqlite3_bind_blob(dbc->stmt, col, key, keylen, d);
+}
+
+/* Iterate over the key range [pfx, upper) so the key index limits the scan */
+static rpmRC dbiCursorPrepPrefix(dbiIndex dbi, sqlite_cursor *dbc,
+				 const char *pfx, size_t pfxlen)
+{
+    std::string upper(pfx, pfxlen);
+    rpmRC rc;
+
+    while (!upper.empty() && (unsigned char)upper.back() == 0xff)
+	upper.pop_back();
+    if (!upper.empty())
+	upper.back()++;
+
+    if (upper.empty()) {
+	rc = dbiCursorPrep(dbc, "SELECT DISTINCT key FROM '%q' "
+				"WHERE key >= ? ORDER BY key", dbi->dbi_file);
+    } else {
+	rc = dbiCursorPrep(dbc, "SELECT DISTINCT key FROM '%q' "
+				"WHERE key >= ? AND key < ? ORDER BY key",
+				dbi->dbi_file);
+    }
+    if (!rc) {
+	int sqrc = dbiCursorBindKey(dbc, 1, pfx, pfxlen, SQLITE_STATIC);
+	if (!sqrc && !upper.empty())
+	    sqrc = dbiCursorBindKey(dbc, 2, upper.data(), upper.size(),
+				    SQLITE_TRANSIENT);
+	rc = dbiCursorResult(dbc);
+    }
+    return rc;
+}
+
+static rpmRC sqlite_idxdbIter(dbiIndex dbi, dbiCursor _dbc,
+			      const char *pfx, size_t pfxlen, dbiIndexSet *set)
 {
     rpmRC rc = RPMRC_OK;
     sqlite_cursor *dbc = static_cast<sqlite_cursor *>(_dbc);
 
     if (dbc->stmt == NULL) {
-	rc = dbiCursorPrep(dbc, "SELECT DISTINCT key FROM '%q' ORDER BY key",
-				dbi->dbi_file);
+	if (pfx) {
+	    rc = dbiCursorPrepPrefix(dbi, dbc, pfx, pfxlen);
+	} else {
+	    rc = dbiCursorPrep(dbc, "SELECT DISTINCT key FROM '%q' ORDER BY key",
+				    dbi->dbi_file);
+	}
 	if (set)
 	    dbc->subc = sqlite_cursor_init(dbi, 0);
     }
@@ -686,18 +895,80 @@ static rpmRC sqlite_idxdbIter(dbiIndex dbi, dbiCursor _dbc, dbiIndexSet *set)
 static rpmRC sqlite_idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen, dbiIndexSet *set, int searchType)
 {
     rpmRC rc;
-    if (keyp) {
+    if (keyp && !(searchType & DBC_PREFIX_ITER)) {
 	rc = sqlite_idxdbByKey(dbi, dbc, keyp, keylen, searchType, set);
     } else {
-	rc = sqlite_idxdbIter(dbi, dbc, set);
+	rc = sqlite_idxdbIter(dbi, dbc, keyp, keylen, set);
     }
 
     return rc;
 }
 
+/* Insert the pending index rows, as many per statement as possible */
+static rpmRC sqlite_idxdbFlush(dbiIndex dbi, sqlite_cursor *dbc)
+{
+    rpmRC rc = RPMRC_OK;
+    size_t nrows = dbc->rows.size();
+    size_t i = 0;
+
+    for (size_t n = batch_rows; n > 0 && rc == RPMRC_OK; n /= 2) {
+	if (nrows - i < n)
+	    continue;
+
+	std::string fmt = "INSERT INTO '%q' VALUES(?, ?, ?)";
+	for (size_t j = 1; j < n; j++)
+	    fmt += ", (?, ?, ?)";
+	char *cmd = sqlite3_mprintf(fmt.c_str(), dbi->dbi_file);
+	sqlite3_stmt *stmt = stmtGet(dbc->cache, dbc->sdb, cmd);
+	sqlite3_free(cmd);
+
+	if (stmt == NULL)
+	    rc = RPMRC_FAIL;
+
+	while (rc == RPMRC_OK && nrows - i >= n) {
+	    int sqrc = SQLITE_OK;
+	    for (size_t j = 0; j < n && sqrc == SQLITE_OK; j++, i++) {
+		const sqlite_row & row = dbc->rows[i];
+		int col = 3 * j + 1;
+		if (dbc->ctype == SQLITE_TEXT) {
+		    sqrc = sqlite3_bind_text(stmt, col, row.key.data(),
+					     row.key.size(), SQLITE_STATIC);
+		} else {
+		    sqrc = sqlite3_bind_blob(stmt, col, row.key.data(),
+					     row.key.size(), SQLITE_STATIC);
+		}
+		if (sqrc == SQLITE_OK)
+		    sqrc = sqlite3_bind_int(stmt, col + 1, row.hdrNum);
+		if (sqrc == SQLITE_OK)
+		    sqrc = sqlite3_bind_int(stmt, col + 2, row.tagNum);
+	    }
+	    if (sqrc == SQLITE_OK)
+		while ((sqrc = sqlite3_step(stmt)) == SQLITE_ROW) {};
+
+	    if (sqrc != SQLITE_DONE) {
+		rpmlog(RPMLOG_ERR, "%s: %d: %s\n", sqlite3_sql(stmt),
+			sqlite3_errcode(dbc->sdb), sqlite3_errmsg(dbc->sdb));
+		rc = RPMRC_FAIL;
+	    }
+	    sqlite3_reset(stmt);
+	}
+	stmtPut(dbc->cache, stmt);
+    }
+    dbc->rows.clear();
+
+    return rc;
+}
+
 static rpmRC sqlite_idxdbPutOne(dbiIndex dbi, dbiCursor _dbc, const char *keyp, size_t keylen, dbiIndexItem rec)
 {
     sqlite_cursor *dbc = static_cast<sqlite_cursor *>(_dbc);
+
+    if (dbc->batch) {
+	dbc->rows.push_back({std::string(keyp, keylen), rec->hdrNum, rec->tagNum});
+	return (dbc->rows.size() >= batch_rows * 16) ?
+		sqlite_idxdbFlush(dbi, dbc) : RPMRC_OK;
+    }
+
     rpmRC rc = dbiCursorPrep(dbc, "INSERT INTO '%q' VALUES(?, ?, ?)",
 			dbi->dbi_file);
 
@@ -712,7 +983,86 @@ static rpmRC sqlite_idxdbPutOne(dbiIndex dbi, dbiCursor _dbc, const char *keyp,
 
 static rpmRC sqlite_idxdbPut(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h)
 {
-    return tag2index(dbi, rpmtag, hdrNum, h, sqlite_idxdbPutOne);
+    /*
+     * Rows are only written on flush, which happens inside the caller's
+     * write lock, so this needs no savepoint of its own.
+     */
+    sqlite_cursor *dbc = sqlite_cursor_init(dbi, DBC_READ);
+    rpmRC rc;
+
+    dbc->batch = 1;
+    rc = tag2keys(dbi, dbc, rpmtag, hdrNum, h, sqlite_idxdbPutOne);
+    if (!rc)
+	rc = sqlite_idxdbFlush(dbi, dbc);
+
+    sqlite_cursor_free(dbi, dbc);
+    return rc;
+}
+
+/* Column data is only valid until the next step, it must be copied */
+static unsigned char * sqlite_pkgdbTake(dbiIndex dbi, dbiCursor dbc, unsigned char *hdrBlob)
+{
+    return NULL;
+}
+
+static rpmRC sqlite_sumdbGet(dbiIndex dbi, dbiCursor _dbc, unsigned int hdrNum, unsigned char **sumBlob, unsigned int *sumLen)
+{
+    sqlite_cursor *dbc = static_cast<sqlite_cursor *>(_dbc);
+    rpmRC rc = RPMRC_OK;
+
+    if (hdrNum) {
+	rc = dbiCursorPrep(dbc, "SELECT hnum, blob FROM 'Summary' WHERE hnum=?");
+	if (!rc)
+	    rc = dbiCursorBindPkg(dbc, hdrNum, NULL, 0);
+	if (!rc)
+	    rc = sqlite_stepPkg(dbc, sumBlob, sumLen);
+    } else {
+	/* Packages without a summary come with a NULL blob */
+	if (dbc->stmt == NULL) {
+	    rc = dbiCursorPrep(dbc, "SELECT p.hnum, s.blob FROM '%q' AS p "
+				    "LEFT JOIN 'Summary' AS s ON s.hnum=p.hnum",
+				    dbi->dbi_file);
+	}
+	if (!rc)
+	    rc = sqlite_stepPkg(dbc, sumBlob, sumLen);
+    }
+
+    return rc;
+}
+
+static rpmRC sqlite_sumdbPut(dbiIndex dbi, dbiCursor _dbc, unsigned int hdrNum, unsigned char *sumBlob, unsigned int sumLen)
+{
+    sqlite_cursor *dbc = static_cast<sqlite_cursor *>(_dbc);
+    rpmRC rc = dbiCursorPrep(dbc, "INSERT OR REPLACE INTO 'Summary' VALUES(?, ?)");
+
+    if (!rc)
+	rc = dbiCursorBindPkg(dbc, hdrNum, sumBlob, sumLen);
+
+    if (!rc)
+	while (sqlite3_step(dbc->stmt) == SQLITE_ROW) {};
+
+    return dbiCursorResult(dbc);
+}
+
+static rpmRC sqlite_idxdbPutSet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen, dbiIndexSet set)
+{
+    sqlite_cursor *sdbc = static_cast<sqlite_cursor *>(dbc);
+    rpmRC rc = RPMRC_OK;
+    unsigned int n = dbiIndexSetCount(set);
+
+    sdbc->batch = 1;
+    for (unsigned int i = 0; i < n && rc == RPMRC_OK; i++) {
+	struct dbiIndexItem_s rec = {
+	    .hdrNum = dbiIndexRecordOffset(set, i),
+	    .tagNum = dbiIndexRecordFileNumber(set, i),
+	};
+	rc = sqlite_idxdbPutOne(dbi, dbc, keyp, keylen, &rec);
+    }
+    if (!rc)
+	rc = sqlite_idxdbFlush(dbi, sdbc);
+    sdbc->rows.clear();
+    sdbc->batch = 0;
+    return rc;
 }
 
 static rpmRC sqlite_idxdbDel(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h)
@@ -766,6 +1116,10 @@ struct rpmdbOps_s sqlite_dbops = {
     .idxdbGet	= sqlite_idxdbGet,
     .idxdbPut	= sqlite_idxdbPut,
     .idxdbDel	= sqlite_idxdbDel,
-    .idxdbKey	= sqlite_idxdbKey
+    .idxdbKey	= sqlite_idxdbKey,
+    .idxdbPutSet = sqlite_idxdbPutSet,
+    .pkgdbTake	= sqlite_pkgdbTake,
+    .sumdbGet	= sqlite_sumdbGet,
+    .sumdbPut	= sqlite_sumdbPut
 };
 
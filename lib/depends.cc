@@ -4,13 +4,20 @@
 
 #include "system.h"
 
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <rpm/rpmlib.h>		/* rpmVersionCompare, rpmlib provides */
 #include <rpm/rpmtag.h>
 #include <rpm/rpmlog.h>
+#include <rpm/rpmmacro.h>
 #include <rpm/rpmdb.h>
 #include <rpm/rpmds.h>
 #include <rpm/rpmfi.h>
@@ -36,7 +43,55 @@ const char * const rpmEVR = VERSION;
 
 const int rpmFLAGS = RPMSENSE_EQUAL;
 
-using depCache = std::unordered_map<std::string,int>;
+/*
+ * Rich dependency compiled into an expression tree. Leaves are simple
+ * dependencies whose result can be remembered for the whole check.
+ */
+struct richNode {
+    rpmds ds = NULL;			/* (sub)dependency of this node */
+    rpmrichOp op = RPMRICHOP_SINGLE;
+    std::unique_ptr<richNode> left;
+    std::unique_ptr<richNode> right;
+    char *emsg = NULL;			/* parse error message */
+    int failed = 0;			/* parse error? */
+    int result = -1;			/* memoized leaf result */
+
+    ~richNode() {
+	rpmdsFree(ds);
+	free(emsg);
+    }
+};
+
+/* The tree of a rich dep only depends on its string, tag and flags */
+using richKey = std::tuple<rpmsid,rpmTagVal,rpmsenseFlags>;
+
+/*
+ * Dependency check state shared by all elements. Elements may be checked
+ * from several threads: cached results are looked up under a shared lock,
+ * and everything touching the rpmdb, the solver or other non-reentrant
+ * state is serialized with the (recursive, for rich deps) lock.
+ */
+struct depCache {
+    std::unordered_map<std::string,int> results;
+    std::shared_mutex resultsLock;
+    std::recursive_mutex lock;
+    std::map<richKey,std::unique_ptr<richNode>> rich;	/* under lock */
+    int memo = 0;			/* memoize rich dep leaf results? */
+
+    int get(const std::string & key, int *rc) {
+	std::shared_lock<std::shared_mutex> guard(resultsLock);
+	auto ret = results.find(key);
+	if (ret == results.end())
+	    return 0;
+	*rc = ret->second;
+	return 1;
+    }
+    void put(const std::string & key, int rc) {
+	std::unique_lock<std::shared_mutex> guard(resultsLock);
+	results.insert({key, rc});
+    }
+};
+
 using depexistsHash = std::unordered_set<rpmsid>;
 using filedepHash = std::unordered_map<rpmsid,rpmsid>;
 
@@ -492,6 +547,17 @@ int rpmtsAddEraseElement(rpmts ts, Header h, int dboffset)
     return removePackage(ts, h, NULL);
 }
 
+/* Tags rpmdsMatches() needs from installed headers */
+static const rpmTagVal provideTags[] = {
+    RPMTAG_NAME,
+    RPMTAG_EPOCH,
+    RPMTAG_VERSION,
+    RPMTAG_RELEASE,
+    RPMTAG_PROVIDENAME,
+    RPMTAG_PROVIDEVERSION,
+    RPMTAG_PROVIDEFLAGS,
+};
+
 /* Cached rpmdb provide lookup, returns 0 if satisfied, 1 otherwise */
 static int rpmdbProvides(rpmts ts, depCache *dcache, rpmds dep, dbiIndexSet *matches)
 {
@@ -506,14 +572,17 @@ static int rpmdbProvides(rpmts ts, depCache *dcache, rpmds dep, dbiIndexSet *mat
 
     /* See if we already looked this up */
     if (prune && !matches) {
-	auto ret = dcache->find(DNEVR);
-	if (ret != dcache->end()) {
-	    rc = ret->second;
+	if (dcache->get(DNEVR, &rc)) {
 	    rpmdsNotify(dep, "(cached)", rc);
 	    return rc;
 	}
     }
 
+    /* Set mode callers (dcache NULL) already hold the lock */
+    std::unique_lock<std::recursive_mutex> guard;
+    if (dcache)
+	guard = std::unique_lock<std::recursive_mutex>(dcache->lock);
+
     if (matches)
 	*matches = dbiIndexSetNew(0);
     /*
@@ -552,6 +621,9 @@ static int rpmdbProvides(rpmts ts, depCache *dcache, rpmds dep, dbiIndexSet *mat
 	}
 
 	mi = rpmtsPrunedIterator(ts, dbtag, Name, prune);
+	/* The provides and EVR are all we need, avoid full header loads */
+	rpmdbSetIteratorSummary(mi, provideTags,
+				sizeof(provideTags) / sizeof(*provideTags));
 	while ((h = rpmdbNextIterator(mi)) != NULL) {
 	    /* Provide-indexes can't be used with nevr-only matching */
 	    int prix = (selfevr) ? -1 : rpmdbGetIteratorFileNum(mi);
@@ -583,7 +655,7 @@ static int rpmdbProvides(rpmts ts, depCache *dcache, rpmds dep, dbiIndexSet *mat
     /* Cache the relatively expensive rpmdb lookup results */
     /* Caching the oddball non-pruned case would mess up other results */
     if (prune && !matches)
-	dcache->insert({DNEVR, rc});
+	dcache->put(DNEVR, rc);
     return rc;
 }
 
@@ -665,7 +737,7 @@ static int isDep(const char *depn, size_t dlen, const char *dtype,
     return rc;
 }
 
-static int systemProvides(rpmts ts, rpmds dep)
+static int systemProvides(rpmts ts, depCache *dcache, rpmds dep)
 {
     int rc = 1;
     const char *dtype = NULL;
@@ -674,10 +746,12 @@ static int systemProvides(rpmts ts, rpmds dep)
     char *dval = NULL;
 
     if (isDep(n, nlen, "user(", &dval)) {
+	std::lock_guard<std::recursive_mutex> guard(dcache->lock);
 	uid_t uid = 0;
 	rc = rpmugUid(dval, &uid) < 0;
 	dtype = "(system user)";
     } else if (isDep(n, nlen, "group(", &dval)) {
+	std::lock_guard<std::recursive_mutex> guard(dcache->lock);
 	gid_t gid = 0;
 	rc = rpmugGid(dval, &gid) < 0;
 	dtype = "(system group)";
@@ -690,6 +764,103 @@ static int systemProvides(rpmts ts, rpmds dep)
     return rc;
 }
 
+static int unsatisfiedDepend(rpmts ts, depCache *dcache, rpmds dep);
+
+/* Compile a single-entry rich dependency, takes over the ds reference */
+static richNode *richCompile(rpmds ds)
+{
+    richNode *node = new richNode {};
+    rpmds ds1 = NULL, ds2 = NULL;
+
+    node->ds = ds;
+    if (!rpmdsIsRich(ds))
+	return node;
+
+    if (rpmdsParseRichDep(ds, &ds1, &ds2, &node->op, &node->emsg) != RPMRC_OK) {
+	node->failed = 1;
+	return node;
+    }
+    node->left.reset(richCompile(ds1));
+    if (ds2)
+	node->right.reset(richCompile(ds2));
+    return node;
+}
+
+static int richEval(rpmts ts, depCache *dcache, richNode *node, rpmds dep);
+
+static int richEvalNode(rpmts ts, depCache *dcache, richNode *node)
+{
+    /* Sub-dependencies are instance-less, rich ones go straight to richEval */
+    if (rpmdsIsRich(node->ds))
+	return richEval(ts, dcache, node, node->ds);
+
+    if (node->result < 0 || !dcache->memo) {
+	node->result = unsatisfiedDepend(ts, dcache, node->ds);
+    } else {
+	rpmdsNotify(node->ds, "(cached)", node->result);
+    }
+    return node->result;
+}
+
+/* Evaluate a compiled rich dependency, dep is used for reporting */
+static int richEval(rpmts ts, depCache *dcache, richNode *node, rpmds dep)
+{
+    rpmrichOp op = node->op;
+    int rc;
+
+    if (node->failed) {
+	rc = rpmdsTagN(dep) == RPMTAG_CONFLICTNAME ? 0 : 1;
+	if (rpmdsInstance(dep) != 0)
+	    rc = !rc;	/* ignore errors for installed packages */
+	rpmdsNotify(dep, node->emsg ? node->emsg : "(parse error)", rc);
+	return rc;
+    }
+
+    if (op == RPMRICHOP_WITH || op == RPMRICHOP_WITHOUT) {
+	/* switch to set mode processing */
+	dbiIndexSet set = unsatisfiedDependSet(ts, dep);
+	rc = dbiIndexSetCount(set) ? 0 : 1;
+	dbiIndexSetFree(set);
+    } else if (op == RPMRICHOP_IF || op == RPMRICHOP_UNLESS) {
+	/* A IF B -> A OR NOT(B) */
+	/* A UNLESS B -> A AND NOT(B) */
+	richNode *cond = node->right.get();
+	if (rpmdsIsRich(cond->ds) && !cond->failed && cond->op == RPMRICHOP_ELSE) {
+	    /* A IF B ELSE C -> (A OR NOT(B)) AND (C OR B) */
+	    /* A UNLESS B ELSE C -> (A AND NOT(B)) OR (C AND B) */
+	    rc = !richEvalNode(ts, dcache, cond->left.get());	/* NOT(B) */
+	    if ((rc && op == RPMRICHOP_IF) || (!rc && op == RPMRICHOP_UNLESS)) {
+		rc = richEvalNode(ts, dcache, node->left.get());	/* A */
+	    } else {
+		rc = richEvalNode(ts, dcache, cond->right.get());	/* C */
+	    }
+	} else {
+	    rc = !richEvalNode(ts, dcache, cond);	/* NOT(B) */
+	    if ((rc && op == RPMRICHOP_IF) || (!rc && op == RPMRICHOP_UNLESS))
+		rc = richEvalNode(ts, dcache, node->left.get());
+	}
+    } else {
+	rc = richEvalNode(ts, dcache, node->left.get());
+	if ((rc && op == RPMRICHOP_OR) || (!rc && op == RPMRICHOP_AND))
+	    rc = richEvalNode(ts, dcache, node->right.get());
+    }
+    rpmdsNotify(dep, "(rich)", rc);
+    return rc;
+}
+
+/* Look up the compiled form of a rich dependency, compiling on first use */
+static richNode *richLookup(depCache *dcache, rpmds dep)
+{
+    rpmsenseFlags flags = rpmdsFlags(dep) &
+			  ~(RPMSENSE_SENSEMASK | RPMSENSE_MISSINGOK);
+    richKey key { rpmdsNId(dep), rpmdsTagN(dep), flags };
+    auto & node = dcache->rich[key];
+
+    if (!node)
+	node.reset(richCompile(rpmdsCurrent(dep)));
+    return node.get();
+}
+
 /**
  * Check dep for an unsatisfied dependency.
  * @param ts		transaction set
@@ -714,10 +885,15 @@ retry:
      * Check those dependencies now.
      */
     if (dsflags & RPMSENSE_RPMLIB) {
-	if (tsmem->rpmlib == NULL)
-	    rpmdsRpmlibPool(rpmtsPool(ts), &(tsmem->rpmlib), NULL);
-	
-	if (tsmem->rpmlib != NULL && rpmdsSearch(tsmem->rpmlib, dep) >= 0) {
+	int found;
+	{
+	    std::lock_guard<std::recursive_mutex> guard(dcache->lock);
+	    if (tsmem->rpmlib == NULL)
+		rpmdsRpmlibPool(rpmtsPool(ts), &(tsmem->rpmlib), NULL);
+	    found = (tsmem->rpmlib != NULL &&
+		     rpmdsSearch(tsmem->rpmlib, dep) >= 0);
+	}
+	if (found) {
 	    rpmdsNotify(dep, "(rpmlib provides)", rc);
 	    goto exit;
 	}
@@ -725,7 +901,7 @@ retry:
     }
 
     /* See if the runtime system provides it, similar to rpmlib provides */
-    if (systemProvides(ts, dep) == 0)
+    if (systemProvides(ts, dcache, dep) == 0)
 	goto exit;
 
     /* Dont look at pre-requisites of already installed packages */
@@ -734,67 +910,18 @@ retry:
 
     /* Handle rich dependencies */
     if (rpmdsIsRich(dep)) {
-	rpmds ds1, ds2; 
-	rpmrichOp op;
-	char *emsg = 0; 
-	if (rpmdsParseRichDep(dep, &ds1, &ds2, &op, &emsg) != RPMRC_OK) {
-	    rc = rpmdsTagN(dep) == RPMTAG_CONFLICTNAME ? 0 : 1;
-	    if (rpmdsInstance(dep) != 0)
-		rc = !rc;	/* ignore errors for installed packages */
-	    rpmdsNotify(dep, emsg ? emsg : "(parse error)", rc);  
-	    _free(emsg);
-	    goto exit;
-	}
-	if (op == RPMRICHOP_WITH || op == RPMRICHOP_WITHOUT) {
-	    /* switch to set mode processing */
-	    dbiIndexSet set = unsatisfiedDependSet(ts, dep);
-	    rc = dbiIndexSetCount(set) ? 0 : 1;
-	    dbiIndexSetFree(set);
-	    ds1 = rpmdsFree(ds1);
-	    ds2 = rpmdsFree(ds2);
-	    rpmdsNotify(dep, "(rich)", rc);
-	    goto exit;
-	}
-	if (op == RPMRICHOP_IF || op == RPMRICHOP_UNLESS) {
-	    /* A IF B -> A OR NOT(B) */
-	    /* A UNLESS B -> A AND NOT(B) */
-	    if (rpmdsIsRich(ds2)) {
-		/* check if this has an ELSE clause */
-		rpmds ds21 = NULL, ds22 = NULL;
-		rpmrichOp op2;
-		if (rpmdsParseRichDep(ds2, &ds21, &ds22, &op2, NULL) == RPMRC_OK && op2 == RPMRICHOP_ELSE) {
-		    /* A IF B ELSE C -> (A OR NOT(B)) AND (C OR B) */
-		    /* A UNLESS B ELSE C -> (A AND NOT(B)) OR (C AND B) */
-		    rc = !unsatisfiedDepend(ts, dcache, ds21);	/* NOT(B) */
-		    if ((rc && op == RPMRICHOP_IF) || (!rc && op == RPMRICHOP_UNLESS)) {
-			rc = unsatisfiedDepend(ts, dcache, ds1);	/* A */
-		    } else {
-			rc = unsatisfiedDepend(ts, dcache, ds22);	/* C */
-		    }
-		    rpmdsFree(ds21);
-		    rpmdsFree(ds22);
-		    goto exitrich;
-		}
-		rpmdsFree(ds21);
-		rpmdsFree(ds22);
-	    }
-	    rc = !unsatisfiedDepend(ts, dcache, ds2);	/* NOT(B) */
-	    if ((rc && op == RPMRICHOP_IF) || (!rc && op == RPMRICHOP_UNLESS))
-		rc = unsatisfiedDepend(ts, dcache, ds1);
-	} else {
-	    rc = unsatisfiedDepend(ts, dcache, ds1);
-	    if ((rc && op == RPMRICHOP_OR) || (!rc && op == RPMRICHOP_AND))
-		rc = unsatisfiedDepend(ts, dcache, ds2);
-	}
-exitrich:
-	ds1 = rpmdsFree(ds1);
-	ds2 = rpmdsFree(ds2);
-	rpmdsNotify(dep, "(rich)", rc);
+	std::lock_guard<std::recursive_mutex> guard(dcache->lock);
+	rc = richEval(ts, dcache, richLookup(dcache, dep), dep);
 	goto exit;
     }
 
     /* Pretrans dependencies can't be satisfied by added packages. */
     if (!(dsflags & (RPMSENSE_PRETRANS|RPMSENSE_PREUNTRANS))) {
+	/* File lookups build the file index and fingerprints on demand */
+	std::unique_lock<std::recursive_mutex> guard(dcache->lock,
+						     std::defer_lock);
+	if (*rpmdsN(dep) == '/')
+	    guard.lock();
 	auto const matches = rpmalAllSatisfiesDepend(tsmem->addedPackages, dep);
 	if (!matches.empty())
 	    goto exit;
@@ -806,7 +933,9 @@ exitrich:
 
     /* Search for an unsatisfied dependency. */
     if (adding && !retrying && !(dsflags & (RPMSENSE_PRETRANS|RPMSENSE_PREUNTRANS))) {
+	std::unique_lock<std::recursive_mutex> guard(dcache->lock);
 	int xx = rpmtsSolve(ts, dep);
+	guard.unlock();
 	if (xx == 0)
 	    goto exit;
 	if (xx == -1) {
@@ -960,35 +1089,42 @@ static void addDepToHash(rpmstrPool pool, depexistsHash *hash, char *key, size_t
 	hash->insert(rpmstrPoolIdn(pool, key, keylen, 1));
 }
 
+/*
+ * Only file and negated dependencies of installed packages need to be
+ * known up front, walk just those key ranges of the index instead of
+ * every key in it.
+ */
 static void addIndexToDepHashes(rpmts ts, rpmDbiTag tag,
-				depexistsHash *dephash, filedepHash *filehash,
+				filedepHash *filehash,
 				depexistsHash *depnothash, filedepHash *filenothash)
 {
+    static const char * const prefixes[] = { "/", "!", NULL };
     rpmstrPool pool = rpmtsPool(ts);
-    char *key;
-    size_t keylen;
-    rpmdbIndexIterator ii = rpmdbIndexKeyIteratorInit(rpmtsGetRdb(ts), tag);
 
-    if (!ii)
-	return;
-    while ((rpmdbIndexIteratorNext(ii, (const void**)&key, &keylen)) == 0) {
-	if (!key || !keylen)
-	    continue;
-	if (*key == '!' && keylen > 1) {
-	    key++;
-	    keylen--;
-	    if (*key == '/' && filenothash)
-		addFileDepToHash(pool, filenothash, key, keylen);
-	    if (depnothash)
-		addDepToHash(pool, depnothash, key, keylen);
-	} else {
-	    if (*key == '/' && filehash)
+    for (const char * const *pfx = prefixes; *pfx; pfx++) {
+	char *key;
+	size_t keylen;
+	rpmdbIndexIterator ii;
+
+	ii = rpmdbIndexKeyIteratorInitPrefix(rpmtsGetRdb(ts), tag, *pfx, 0);
+	if (!ii)
+	    return;
+	while ((rpmdbIndexIteratorNext(ii, (const void**)&key, &keylen)) == 0) {
+	    if (!key || !keylen)
+		continue;
+	    if (*key == '!' && keylen > 1) {
+		key++;
+		keylen--;
+		if (*key == '/' && filenothash)
+		    addFileDepToHash(pool, filenothash, key, keylen);
+		if (depnothash)
+		    addDepToHash(pool, depnothash, key, keylen);
+	    } else if (*key == '/' && filehash) {
 		addFileDepToHash(pool, filehash, key, keylen);
-	    if (dephash)
-		addDepToHash(pool, dephash, key, keylen);
+	    }
 	}
+	rpmdbIndexIteratorFree(ii);
     }
-    rpmdbIndexIteratorFree(ii);
 }
 
 static depexistsHash *depexistsHashFree(depexistsHash *hash)
@@ -1018,9 +1154,14 @@ int rpmtsCheck(rpmts ts)
     depexistsHash *reqnothash = NULL;
     fingerPrintCache fpc = NULL;
     rpmdb rdb = NULL;
+    int nthreads = rpmExpandNumeric("%{?_depcheck_nthreads}");
+    std::vector<rpmte> added;
     
     (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_CHECK), 0);
 
+    /* A solver can change the outcome of a rich dep leaf between lookups */
+    dcache->memo = (ts->solve == NULL);
+
     /* Do lazy, readonly, open of rpm database. */
     rdb = rpmtsGetRdb(ts);
     if (rdb == NULL && rpmtsGetDBMode(ts) != -1) {
@@ -1037,7 +1178,7 @@ int rpmtsCheck(rpmts ts)
     confilehash = new filedepHash {};
     connothash = new depexistsHash {};
     connotfilehash = new filedepHash {};
-    addIndexToDepHashes(ts, RPMDBI_CONFLICTNAME, NULL, confilehash, connothash, connotfilehash);
+    addIndexToDepHashes(ts, RPMDBI_CONFLICTNAME, confilehash, connothash, connotfilehash);
     if (confilehash->empty())
 	confilehash = filedepHashFree(confilehash);
     if (connothash->empty())
@@ -1049,7 +1190,7 @@ int rpmtsCheck(rpmts ts)
     reqfilehash = new filedepHash {};
     reqnothash = new depexistsHash {};
     reqnotfilehash = new filedepHash {};
-    addIndexToDepHashes(ts, RPMDBI_REQUIRENAME, NULL, reqfilehash, reqnothash, reqnotfilehash);
+    addIndexToDepHashes(ts, RPMDBI_REQUIRENAME, reqfilehash, reqnothash, reqnotfilehash);
     if (reqfilehash->empty())
 	reqfilehash = filedepHashFree(reqfilehash);
     if (reqnothash->empty())
@@ -1060,23 +1201,53 @@ int rpmtsCheck(rpmts ts)
     /* Enable system provides lookup from the target root */
     rpmChrootSet(rpmtsRootDir(ts));
 
+    /*
+     * The own dependencies of the added packages can be checked in
+     * parallel. Each element is handled by one thread, so its problems
+     * are recorded in the same order as in a serial check. A solver
+     * callback may change the transaction, so it forces a serial check.
+     */
+    pi = rpmtsiInit(ts);
+    while ((p = rpmtsiNext(pi, TR_ADDED)) != NULL)
+	added.push_back(p);
+    pi = rpmtsiFree(pi);
+
+    if (nthreads > 1 && added.size() > 1 && ts->solve == NULL) {
+	tsMembers tsmem = rpmtsMembers(ts);
+	rpmalMakeIndex(tsmem->addedPackages);
+	#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+	for (size_t i = 0; i < added.size(); i++) {
+	    rpmte te = added[i];
+	    checkDS(ts, dcache, te, rpmteNEVRA(te),
+		    rpmteDS(te, RPMTAG_REQUIRENAME), tscolor);
+	    checkDS(ts, dcache, te, rpmteNEVRA(te),
+		    rpmteDS(te, RPMTAG_CONFLICTNAME), tscolor);
+	    checkDS(ts, dcache, te, rpmteNEVRA(te),
+		    rpmteDS(te, RPMTAG_OBSOLETENAME), tscolor);
+	}
+    } else {
+	nthreads = 1;
+    }
+
     /*
      * Look at all of the added packages and make sure their dependencies
      * are satisfied.
      */
-    pi = rpmtsiInit(ts);
-    while ((p = rpmtsiNext(pi, TR_ADDED)) != NULL) {
+    for (size_t i = 0; i < added.size(); i++) {
+	p = added[i];
 	rpmds provides = rpmdsInit(rpmteDS(p, RPMTAG_PROVIDENAME));
 
 	rpmlog(RPMLOG_DEBUG, "========== +++ %s %s/%s 0x%x\n",
 		rpmteNEVR(p), rpmteA(p), rpmteO(p), rpmteColor(p));
 
-	checkDS(ts, dcache, p, rpmteNEVRA(p), rpmteDS(p, RPMTAG_REQUIRENAME),
-		tscolor);
-	checkDS(ts, dcache, p, rpmteNEVRA(p), rpmteDS(p, RPMTAG_CONFLICTNAME),
-		tscolor);
-	checkDS(ts, dcache, p, rpmteNEVRA(p), rpmteDS(p, RPMTAG_OBSOLETENAME),
-		tscolor);
+	if (nthreads == 1) {
+	    checkDS(ts, dcache, p, rpmteNEVRA(p),
+		    rpmteDS(p, RPMTAG_REQUIRENAME), tscolor);
+	    checkDS(ts, dcache, p, rpmteNEVRA(p),
+		    rpmteDS(p, RPMTAG_CONFLICTNAME), tscolor);
+	    checkDS(ts, dcache, p, rpmteNEVRA(p),
+		    rpmteDS(p, RPMTAG_OBSOLETENAME), tscolor);
+	}
 
 	/* Skip obsoletion and provides checks for source packages (ie build) */
 	if (rpmteIsSource(p))
@@ -1106,7 +1277,6 @@ int rpmtsCheck(rpmts ts)
 	    rpmfilesFree(files);
 	}
     }
-    rpmtsiFree(pi);
 
     /*
      * Look at the removed packages and make sure they aren't critical.
@@ -343,7 +343,7 @@ static char * xmlFormat(rpmtd td, char **emsg)
     return xstrdup(val.c_str());
 }
 
-static char *jsonEscape(const char *s)
+char *rpmJsonEscape(const char *s)
 {
     string es = "\"";
     for (const char *c = s; *c != '\0'; c++) {
@@ -410,7 +410,7 @@ static char *jsonFormat(rpmtd td, char **emsg)
     }
 
     if (escape) {
-	char *s = jsonEscape(val);
+	char *s = rpmJsonEscape(val);
 	free(val);
 	val = s;
     }
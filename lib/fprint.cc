@@ -5,9 +5,16 @@
 #include "system.h"
 
 #include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <rpm/rpmfileutil.h>	/* for rpmCleanPath */
+#include <rpm/rpmmacro.h>
+#include <rpm/rpmlog.h>
 #include <rpm/rpmstring.h>
 #include <rpm/rpmts.h>
 #include <rpm/rpmsq.h>
@@ -71,8 +78,38 @@ struct fpLess
     }
 };
 
+/**
+ * Identity of a directory as far as the persistent cache is concerned.
+ * Creating, removing or renaming entries in a directory always updates
+ * its ctime, so an unchanged parent means its subdirectories are too.
+ */
+struct fpDirStat_s {
+    int ok;				/*!< stat(2) succeeded? */
+    dev_t dev;				/*!< stat(2) device number */
+    ino_t ino;				/*!< stat(2) inode number */
+    struct timespec ctim;		/*!< stat(2) status change time */
+};
+
+/**
+ * Persistent cache entry: a directory and the state of its parent
+ * at the time the directory was looked up. Only real directories on
+ * the same device as their parent are cached, symlinks and mount points
+ * are always looked up with stat(2).
+ */
+struct fpDiskEntry_s {
+    struct fpDirStat_s parent;		/*!< parent directory identity */
+    dev_t dev;				/*!< stat(2) device number */
+    ino_t ino;				/*!< stat(2) inode number */
+};
+
+#define FPCACHE_MAGIC "rpm-fpcache 2"
+/* Upper limit of entries in the persistent cache */
+#define FPCACHE_MAX_ENTRIES 65536
+
 using rpmFpEntryHash = std::unordered_multimap<rpmsid,fprintCacheEntry_s>;
 using rpmFpHash = std::multimap<fingerPrint *,rpmffi_s,fpLess>;
+using rpmFpDiskHash = std::unordered_map<std::string,fpDiskEntry_s>;
+using rpmFpDirStatHash = std::unordered_map<std::string,fpDirStat_s>;
 
 /**
  * Finger print cache.
@@ -81,6 +118,14 @@ struct fprintCache_s {
     rpmFpEntryHash ht;			/*!< hashed by dirName */
     rpmFpHash fp;			/*!< hashed by fingerprint */
     rpmstrPool pool;			/*!< string pool */
+    std::shared_mutex htlock;		/*!< protects ht during parallel lookups */
+    int persist;			/*!< use persistent directory cache? */
+    rpmFpDiskHash disk;			/*!< persistent entries by dirName */
+    rpmFpDiskHash used;			/*!< verified entries of this transaction */
+    std::vector<std::string> diskorder;	/*!< persistent entries, most recent first */
+    rpmFpDirStatHash parents;		/*!< parent stats by dirName */
+    std::mutex disklock;		/*!< protects disk, used and parents */
+    std::string mounts;			/*!< mount table signature */
 };
 
 fingerPrintCache fpCacheCreate(int sizeHint, rpmstrPool pool)
@@ -108,12 +153,279 @@ fingerPrintCache fpCacheFree(fingerPrintCache cache)
 static const struct fprintCacheEntry_s * cacheContainsDirectory(
 			    fingerPrintCache cache, rpmsid dirId)
 {
+    std::shared_lock<std::shared_mutex> lock(cache->htlock);
     auto entry = cache->ht.find(dirId);
     if (entry != cache->ht.end())
 	return &entry->second;
     return NULL;
 }
 
+/**
+ * Add directory name entry to cache, unless another thread beat us to it.
+ * Entries are never removed so the returned pointer stays valid.
+ * @param cache		pointer to fingerprint cache
+ * @param newEntry	directory name entry to add
+ * @return pointer to directory name entry in cache
+ */
+static const struct fprintCacheEntry_s * cacheAddDirectory(
+			    fingerPrintCache cache,
+			    const struct fprintCacheEntry_s & newEntry)
+{
+    std::unique_lock<std::shared_mutex> lock(cache->htlock);
+    auto entry = cache->ht.find(newEntry.dirId);
+    if (entry == cache->ht.end())
+	entry = cache->ht.insert({newEntry.dirId, newEntry});
+    return &entry->second;
+}
+
+/* Return parent of a canonical directory name, empty for the root */
+static std::string parentDir(const char *dn)
+{
+    std::string pdn(dn);
+    while (pdn.size() > 1 && pdn.back() == '/')
+	pdn.pop_back();
+    size_t slash = pdn.rfind('/');
+    if (slash == std::string::npos || pdn.size() <= 1)
+	return "";
+    return pdn.substr(0, slash + 1);
+}
+
+/* Signature of the mount table, any change invalidates the whole cache */
+static std::string mountSignature(void)
+{
+    std::string mi;
+    FILE *f = fopen("/proc/self/mountinfo", "r");
+    if (f) {
+	char buf[BUFSIZ];
+	size_t nb;
+	while ((nb = fread(buf, 1, sizeof(buf), f)) > 0)
+	    mi.append(buf, nb);
+	fclose(f);
+    }
+    char sig[32];
+    snprintf(sig, sizeof(sig), "%zx:%zx", mi.size(), std::hash<std::string>{}(mi));
+    return sig;
+}
+
+static int dirStatEqual(const struct fpDirStat_s & a,
+			const struct fpDirStat_s & b)
+{
+    return (a.ok && b.ok && a.dev == b.dev && a.ino == b.ino &&
+	    a.ctim.tv_sec == b.ctim.tv_sec && a.ctim.tv_nsec == b.ctim.tv_nsec);
+}
+
+/* Stat a parent directory, once per cache lifetime */
+static struct fpDirStat_s cacheParentStat(fingerPrintCache cache,
+					  const std::string & pdn)
+{
+    struct fpDirStat_s ps = {};
+    struct stat sb;
+
+    {
+	std::lock_guard<std::mutex> lock(cache->disklock);
+	auto it = cache->parents.find(pdn);
+	if (it != cache->parents.end())
+	    return it->second;
+    }
+
+    if (!stat(pdn.c_str(), &sb)) {
+	ps.ok = 1;
+	ps.dev = sb.st_dev;
+	ps.ino = sb.st_ino;
+	ps.ctim = sb.st_ctim;
+    }
+
+    std::lock_guard<std::mutex> lock(cache->disklock);
+    return cache->parents.emplace(pdn, ps).first->second;
+}
+
+/**
+ * Determine device and inode of a directory, either from the persistent
+ * cache if its parent is unchanged, or by stat(2). Directories that are
+ * neither symlinks nor mount points are remembered for the next time.
+ * @param cache		pointer to fingerprint cache
+ * @param dn		canonical directory name
+ * @param[out] entry	directory name entry to fill in
+ * @return		0 on success, -1 if the directory does not exist
+ */
+static int cacheStatDirectory(fingerPrintCache cache, const char *dn,
+			      struct fprintCacheEntry_s *entry)
+{
+    struct fpDirStat_s ps = {};
+    std::string pdn;
+    struct stat sb;
+
+    if (cache->persist && !strchr(dn, '\n'))
+	pdn = parentDir(dn);
+
+    if (!pdn.empty()) {
+	/* parent must be examined before the directory itself */
+	ps = cacheParentStat(cache, pdn);
+	std::lock_guard<std::mutex> lock(cache->disklock);
+	auto it = cache->disk.find(dn);
+	if (it != cache->disk.end() && dirStatEqual(ps, it->second.parent) &&
+		it->second.dev == ps.dev) {
+	    entry->dev = it->second.dev;
+	    entry->ino = it->second.ino;
+	    cache->used.insert_or_assign(dn, it->second);
+	    return 0;
+	}
+    }
+
+    if (stat(dn, &sb))
+	return -1;
+    entry->dev = sb.st_dev;
+    entry->ino = sb.st_ino;
+
+    if (ps.ok && S_ISDIR(sb.st_mode) && sb.st_dev == ps.dev) {
+	/* lstat() follows a symlink with a trailing slash, drop it */
+	std::string ldn(dn);
+	while (ldn.size() > 1 && ldn.back() == '/')
+	    ldn.pop_back();
+	struct stat lsb;
+	if (!lstat(ldn.c_str(), &lsb) && S_ISDIR(lsb.st_mode) &&
+		lsb.st_dev == sb.st_dev && lsb.st_ino == sb.st_ino) {
+	    struct fpDiskEntry_s de = { ps, sb.st_dev, sb.st_ino };
+	    std::lock_guard<std::mutex> lock(cache->disklock);
+	    cache->used.insert_or_assign(dn, de);
+	}
+    }
+    return 0;
+}
+
+int fpCacheLoad(fingerPrintCache cache, const char *fn)
+{
+    FILE *f;
+    char *line = NULL;
+    char *magic = NULL;
+    size_t len = 0;
+    int rc = 0;
+
+    cache->persist = 1;
+    cache->mounts = mountSignature();
+    if ((f = fopen(fn, "r")) == NULL) {
+	if (errno != ENOENT)
+	    rc = -1;
+	goto exit;
+    }
+
+    magic = rstrscat(NULL, FPCACHE_MAGIC " ", cache->mounts.c_str(), "\n", NULL);
+    if (getline(&line, &len, f) < 0 || !rstreq(line, magic)) {
+	rpmlog(RPMLOG_DEBUG, "ignoring invalid or stale fingerprint cache %s\n",
+		fn);
+	goto exit;
+    }
+
+    while (getline(&line, &len, f) > 0) {
+	uintmax_t pdev, pino, dev, ino;
+	intmax_t sec;
+	long nsec;
+	int n = 0;
+
+	if (sscanf(line, "%ju %ju %jd %ld %ju %ju %n",
+		   &pdev, &pino, &sec, &nsec, &dev, &ino, &n) != 6 || n == 0)
+	    continue;
+
+	char *dn = line + n;
+	dn[strcspn(dn, "\n")] = '\0';
+	if (*dn != '/' || dn[strlen(dn)-1] != '/')
+	    continue;
+
+	struct fpDiskEntry_s de = {};
+	de.parent.ok = 1;
+	de.parent.dev = pdev;
+	de.parent.ino = pino;
+	de.parent.ctim.tv_sec = sec;
+	de.parent.ctim.tv_nsec = nsec;
+	de.dev = dev;
+	de.ino = ino;
+	if (cache->disk.emplace(dn, de).second)
+	    cache->diskorder.push_back(dn);
+    }
+    rpmlog(RPMLOG_DEBUG, "loaded %zu entries from fingerprint cache %s\n",
+	   cache->disk.size(), fn);
+
+exit:
+    if (f)
+	fclose(f);
+    free(magic);
+    free(line);
+    return rc;
+}
+
+static void writeDiskEntry(FILE *f, const char *dn,
+			   const struct fpDiskEntry_s & de)
+{
+    fprintf(f, "%ju %ju %jd %ld %ju %ju %s\n",
+	    (uintmax_t) de.parent.dev, (uintmax_t) de.parent.ino,
+	    (intmax_t) de.parent.ctim.tv_sec, (long) de.parent.ctim.tv_nsec,
+	    (uintmax_t) de.dev, (uintmax_t) de.ino, dn);
+}
+
+int fpCacheSave(fingerPrintCache cache, const char *fn)
+{
+    std::unordered_set<std::string> written;
+    size_t nwritten = 0;
+    char *tmpfn = NULL;
+    FILE *f = NULL;
+    int rc = -1;
+
+    if (!cache->persist)
+	return 0;
+
+    tmpfn = rstrscat(NULL, fn, ".new", NULL);
+    if ((f = fopen(tmpfn, "w")) == NULL)
+	goto exit;
+
+    fprintf(f, "%s %s\n", FPCACHE_MAGIC, cache->mounts.c_str());
+
+    /* Directories looked up and verified in this transaction */
+    for (auto const & [dn, de] : cache->used) {
+	if (nwritten >= FPCACHE_MAX_ENTRIES)
+	    break;
+	written.insert(dn);
+	writeDiskEntry(f, dn.c_str(), de);
+	nwritten++;
+    }
+
+    /*
+     * Carry over entries not needed this time, unless known to be stale.
+     * The file is kept in most recently used order, so whatever doesn't
+     * fit goes first.
+     */
+    for (auto const & dn : cache->diskorder) {
+	if (nwritten >= FPCACHE_MAX_ENTRIES)
+	    break;
+	if (written.find(dn) != written.end())
+	    continue;
+	/* looked up but not verified this time: symlink or mount point */
+	rpmsid id = rpmstrPoolId(cache->pool, dn.c_str(), 0);
+	if (id && cache->ht.find(id) != cache->ht.end())
+	    continue;
+	auto const & de = cache->disk[dn];
+	auto pit = cache->parents.find(parentDir(dn.c_str()));
+	if (pit != cache->parents.end() && !dirStatEqual(pit->second, de.parent))
+	    continue;
+	writeDiskEntry(f, dn.c_str(), de);
+	nwritten++;
+    }
+
+    if (fclose(f) == 0 && rename(tmpfn, fn) == 0)
+	rc = 0;
+    f = NULL;
+
+exit:
+    if (rc) {
+	rpmlog(RPMLOG_DEBUG, "failed to save fingerprint cache %s: %s\n",
+		fn, strerror(errno));
+	if (f)
+	    fclose(f);
+	unlink(tmpfn);
+    }
+    free(tmpfn);
+    return rc;
+}
+
 static char * canonDir(rpmstrPool pool, rpmsid dirNameId)
 {
     const char * dirName = rpmstrPoolStr(pool, dirNameId);
@@ -149,7 +461,6 @@ static int doLookupId(fingerPrintCache cache,
 	     rpmsid dirNameId, rpmsid baseNameId,
 	     fingerPrint *fp)
 {
-    struct stat sb;
     const struct fprintCacheEntry_s * cacheHit;
     char *cdn = canonDir(cache->pool, dirNameId);
     rpmsid fpId;
@@ -166,14 +477,13 @@ static int doLookupId(fingerPrintCache cache,
 	cacheHit = cacheContainsDirectory(cache, fpId);
 	if (cacheHit != NULL) {
 	    fp->entry = cacheHit;
-	} else if (!stat(rpmstrPoolStr(cache->pool, fpId), &sb)) {
+	} else {
 	    struct fprintCacheEntry_s newEntry = {
 		.dirId = fpId,
-		.dev = sb.st_dev,
-		.ino = sb.st_ino,
 	    };
-	    auto ret = cache->ht.insert({fpId, newEntry});
-	    fp->entry = &ret->second;
+	    if (!cacheStatDirectory(cache, rpmstrPoolStr(cache->pool, fpId),
+				    &newEntry))
+		fp->entry = cacheAddDirectory(cache, newEntry);
 	}
 
         if (fp->entry) {
@@ -403,18 +713,36 @@ void fpCachePopulate(fingerPrintCache fpc, rpmts ts, int fileCount)
     rpmfiles fi;
     int i, fc;
     int havesymlinks = 0;
+    int nthreads = rpmExpandNumeric("%{?_fprint_nthreads}");
+    std::vector<rpmte> tes;
+    std::vector<rpmfiles> fis;
 
     rpmFpHash symlinks;
 
-    /* populate the fingerprints of all packages in the transaction */
-    /* also create a hash of all symlinks in the new packages */
     pi = rpmtsiInit(ts);
     while ((p = rpmtsiNext(pi, 0)) != NULL) {
 	if ((fi = rpmteFiles(p)) == NULL)
 	    continue;
+	tes.push_back(p);
+	fis.push_back(fi);
+    }
+    rpmtsiFree(pi);
+
+    /* populate the fingerprints of all packages in the transaction */
+    (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), 0);
+    if (nthreads < 1)
+	nthreads = 1;
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads) if (nthreads > 1)
+    for (size_t j = 0; j < fis.size(); j++)
+	rpmfilesFpLookup(fis[j], fpc);
+    (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), 0);
+
+    /* create a hash of all symlinks in the new packages */
+    for (size_t j = 0; j < tes.size(); j++) {
+	p = tes[j];
+	fi = fis[j];
 
 	(void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), 0);
-	rpmfilesFpLookup(fi, fpc);
 	fs = rpmteGetFileStates(p);
 	fc = rpmfsFC(fs);
 
@@ -441,7 +769,6 @@ void fpCachePopulate(fingerPrintCache fpc, rpmts ts, int fileCount)
 	(void) rpmswExit(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), fc);
 	rpmfilesFree(fi);
     }
-    rpmtsiFree(pi);
 
     /* ===============================================
      * Create the fingerprint -> (p, fileno) hash table
@@ -37,6 +37,25 @@ fingerPrintCache fpCacheCreate(int sizeHint, rpmstrPool pool);
 RPM_GNUC_INTERNAL
 fingerPrintCache fpCacheFree(fingerPrintCache cache);
 
+/**
+ * Enable persistent directory cache and load it from disk, if it exists.
+ * Cached directories are only trusted if their parent is unchanged.
+ * @param cache		pointer to fingerprint cache
+ * @param fn		persistent cache file name
+ * @return		0 on success
+ */
+RPM_GNUC_INTERNAL
+int fpCacheLoad(fingerPrintCache cache, const char *fn);
+
+/**
+ * Save directories looked up so far to persistent directory cache.
+ * @param cache		pointer to fingerprint cache
+ * @param fn		persistent cache file name
+ * @return		0 on success
+ */
+RPM_GNUC_INTERNAL
+int fpCacheSave(fingerPrintCache cache, const char *fn);
+
 RPM_GNUC_INTERNAL
 fingerPrint * fpCacheGetByFp(fingerPrintCache cache,
 			     struct fingerPrint * fp, int ix,
@@ -12,6 +12,15 @@
 #ifdef WITH_CAP
 #include <sys/capability.h>
 #endif
+#ifdef ENABLE_OPENMP
+#include <omp.h>
+#endif
+#ifdef WITH_LIBURING
+#include <liburing.h>
+#endif
+
+#include <atomic>
+#include <vector>
 
 #include <rpm/rpmte.h>
 #include <rpm/rpmts.h>
@@ -41,6 +50,9 @@ static int strict_erasures = 0;
 #define _dirPerms 0755
 #define _filePerms 0644
 
+/* Maximum amount of file content buffered for writer threads */
+#define UNPACK_BUFSIZE (32 * 1024 * 1024)
+
 enum filestage_e {
     FILE_COMMIT = -1,
     FILE_NONE   = 0,
@@ -54,6 +66,8 @@ struct filedata_s {
     int stage;
     int setmeta;
     int skip;
+    int deferred;	/* content written by a writer thread */
+    int wrc;		/* writer thread result */
     rpmFileAction action;
     const char *suffix;
     char *fpath;
@@ -68,6 +82,14 @@ static const char * fileActionString(rpmFileAction a);
 static int fsmOpenat(int *fdp, int dirfd, const char *path, int flags, int dir);
 static int fsmClose(int *wfdp);
 
+struct unpacker_s {
+    int nthreads;			/* number of writer threads */
+    int nodigest;			/* skip file digest checks? */
+    std::atomic<size_t> buffered;	/* amount of content queued */
+    std::atomic<int> failed;		/* has any writer failed? */
+    int parallel;			/* other packages unpacking concurrently? */
+};
+
 /** \ingroup payload
  * Build path to file from file info, optionally ornamented with suffix.
  * "/" needs special handling to avoid appearing as empty path.
@@ -134,21 +156,27 @@ static int fsmSetFCaps(int fd, int dirfd, const char *path, const char *captxt)
     return rc;
 }
 
+int rpmfsmFlushIO(void)
+{
+    static const int flush_io = rpmExpandNumeric("%{?_flush_io}");
+    return flush_io;
+}
+
 static int fsmClose(int *wfdp)
 {
     int rc = 0;
     if (wfdp && *wfdp >= 0) {
 	int myerrno = errno;
-	static int oneshot = 0;
-	static int flush_io = 0;
+	int flush_io = rpmfsmFlushIO();
 	int fdno = *wfdp;
 
-	if (!oneshot) {
-	    flush_io = (rpmExpandNumeric("%{?_flush_io}") > 0);
-	    oneshot = 1;
-	}
-	if (flush_io) {
+	if (flush_io == 1) {
 	    fsync(fdno);
+	} else if (flush_io > 1) {
+#ifdef SYNC_FILE_RANGE_WRITE
+	    /* Just start writeback, the package is synced as a whole later */
+	    sync_file_range(fdno, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
 	}
 	if (close(fdno))
 	    rc = RPMERR_CLOSE_FAILED;
@@ -194,8 +222,110 @@ static int fsmUnpack(rpmfi fi, int fdno, rpmpsm psm, int nodigest)
     return rc;
 }
 
+/*
+ * Write out and digest buffered file content, run as a writer thread task.
+ * Takes ownership of both the fd and the buffer.
+ */
+static void fsmWriteBuffer(struct unpacker_s *up, rpmfiles files, int fx,
+			   struct filedata_s *fp, int fd,
+			   uint8_t *buf, size_t len)
+{
+    int rc = 0;
+    size_t off = 0;
+
+    while (off < len) {
+	ssize_t nb = write(fd, buf + off, len - off);
+	if (nb < 0) {
+	    if (errno == EINTR)
+		continue;
+	    rc = RPMERR_WRITE_FAILED;
+	    break;
+	}
+	off += nb;
+    }
+
+    if (!rc && !up->nodigest) {
+	int digestalgo = rpmfilesDigestAlgo(files);
+	DIGEST_CTX ctx = rpmDigestInit(digestalgo, RPMDIGEST_NONE);
+	void *digest = NULL;
+
+	rpmDigestUpdate(ctx, buf, len);
+	rpmDigestFinal(ctx, &digest, NULL, 0);
+	rc = rpmfilesCheckFDigest(files, fx, digestalgo, digest);
+	free(digest);
+    }
+
+    if (fsmClose(&fd) && !rc)
+	rc = RPMERR_CLOSE_FAILED;
+
+    if (_fsm_debug) {
+	rpmlog(RPMLOG_DEBUG, " %8s (%s %zu bytes) %d\n", __func__,
+	       fp->fpath, len, rc);
+    }
+
+    fp->wrc = rc;
+    if (rc)
+	up->failed = 1;
+    up->buffered -= len;
+    free(buf);
+}
+
+/*
+ * Read file content from the payload into memory and hand it over to
+ * a writer thread. Files too large to buffer are unpacked directly.
+ */
+static int fsmUnpackAsync(struct unpacker_s *up, rpmfi fi,
+			  struct filedata_s *fp, int *fdp, rpmpsm psm)
+{
+    rpm_loff_t fsize = rpmfiFSize(fi);
+    uint8_t *buf = NULL;
+    size_t off = 0;
+    int rc = 0;
+
+    if (fsize > UNPACK_BUFSIZE) {
+	rc = fsmUnpack(fi, *fdp, psm, up->nodigest);
+	goto exit;
+    }
+
+    /* Wait for the writers to catch up if we're too far ahead */
+    if (up->buffered + fsize > UNPACK_BUFSIZE) {
+	#pragma omp taskwait
+    }
+
+    buf = (uint8_t *)xmalloc(fsize);
+    while (off < fsize) {
+	size_t len = fsize - off;
+	if (len > BUFSIZ*4)
+	    len = BUFSIZ*4;
+	if (rpmfiArchiveRead(fi, buf + off, len) != (ssize_t)len) {
+	    rc = RPMERR_READ_FAILED;
+	    goto exit;
+	}
+	off += len;
+	rpmpsmNotify(psm, RPMCALLBACK_INST_PROGRESS, rpmfiArchiveTell(fi));
+    }
+
+    {
+	rpmfiles files = rpmfiFiles(fi);
+	int fx = rpmfiFX(fi);
+	int fd = *fdp;
+
+	fp->deferred = 1;
+	up->buffered += fsize;
+	*fdp = -1;
+
+	#pragma omp task firstprivate(up, files, fx, fp, fd, buf, fsize)
+	fsmWriteBuffer(up, files, fx, fp, fd, buf, fsize);
+	buf = NULL;
+    }
+
+exit:
+    free(buf);
+    return rc;
+}
+
 static int fsmMkfile(int dirfd, rpmfi fi, struct filedata_s *fp, rpmfiles files,
-		     rpmpsm psm, int nodigest,
+		     rpmpsm psm, struct unpacker_s *up,
 		     struct filedata_s ** firstlink, int *firstlinkfile,
 		     int *firstdir, int *fdp)
 {
@@ -221,8 +351,12 @@ static int fsmMkfile(int dirfd, rpmfi fi, struct filedata_s *fp, rpmfiles files,
 
     /* If the file has content, unpack it */
     if (rpmfiArchiveHasContent(fi)) {
-	if (!rc)
-	    rc = fsmUnpack(fi, fd, psm, nodigest);
+	if (!rc) {
+	    if (up->nthreads > 1)
+		rc = fsmUnpackAsync(up, fi, fp, &fd, psm);
+	    else
+		rc = fsmUnpack(fi, fd, psm, up->nodigest);
+	}
 	/* Last file of hardlink set, ensure metadata gets set */
 	if (*firstlink) {
 	    fp->setmeta = 1;
@@ -346,7 +480,7 @@ static int fsmOpenat(int *wfdp, int dirfd, const char *path, int flags, int dir)
 
 static int fsmDoMkDir(rpmPlugins plugins, int dirfd, const char *dn,
 			const char *apath,
-			int owned, mode_t mode, int *fdp)
+			int owned, int parallel, mode_t mode, int *fdp)
 {
     int rc;
     rpmFsmOp op = (FA_CREATE);
@@ -359,6 +493,10 @@ static int fsmDoMkDir(rpmPlugins plugins, int dirfd, const char *dn,
     if (!rc)
 	rc = fsmMkdir(dirfd, dn, mode);
 
+    /* Somebody else (a parallel install) may have beaten us to it */
+    if (parallel && rc == RPMERR_MKDIR_FAILED && errno == EEXIST)
+	rc = 0;
+
     if (!rc) {
 	rc = fsmOpenat(fdp, dirfd, dn, O_RDONLY|O_NOFOLLOW, 1);
     }
@@ -380,7 +518,7 @@ static int fsmDoMkDir(rpmPlugins plugins, int dirfd, const char *dn,
 }
 
 static int ensureDir(rpmPlugins plugins, const char *p, int owned, int create,
-		    int quiet, int *dirfdp)
+		    int parallel, int quiet, int *dirfdp)
 {
     char *sp = NULL, *bn;
     char *apath = NULL;
@@ -403,7 +541,8 @@ static int ensureDir(rpmPlugins plugins, const char *p, int owned, int create,
 
 	if (rc && errno == ENOENT && create) {
 	    mode_t mode = S_IFDIR | (_dirPerms & 07777);
-	    rc = fsmDoMkDir(plugins, dirfd, bn, apath, owned, mode, &fd);
+	    rc = fsmDoMkDir(plugins, dirfd, bn, apath, owned, parallel,
+			    mode, &fd);
 	}
 
 	fsmClose(&dirfd);
@@ -800,6 +939,165 @@ static int fsmCommit(int dirfd, char **path, rpmfi fi, rpmFileAction action, con
     return rc;
 }
 
+#define COMMIT_BATCH 64
+
+/* A queued rename of a file to its final destination */
+struct commitEntry {
+    int fx;		/* file index */
+    int dirfd;		/* directory of the file */
+    char *dest;		/* destination name */
+};
+
+/* Renames of a directory's worth of files, submitted to io_uring at once */
+struct committer_s {
+#ifdef WITH_LIBURING
+    struct io_uring ring;
+#endif
+    int enabled;
+    int nqueued;	/* number of pending entries on the ring */
+    std::vector<commitEntry> pending;
+};
+
+static void committerInit(struct committer_s *cm)
+{
+    cm->enabled = 0;
+    cm->nqueued = 0;
+#ifdef WITH_LIBURING
+    /* Fall back to plain syscalls if io_uring is not available */
+    if (rpmExpandNumeric("%{?_fsm_uring}") > 0)
+	cm->enabled = (io_uring_queue_init(COMMIT_BATCH, &cm->ring, 0) == 0);
+#endif
+}
+
+static void committerFini(struct committer_s *cm)
+{
+#ifdef WITH_LIBURING
+    if (cm->enabled)
+	io_uring_queue_exit(&cm->ring);
+#endif
+    cm->enabled = 0;
+    cm->nqueued = 0;
+}
+
+/* Can the commit of this file be queued instead of done immediately? */
+static int committerCanQueue(struct committer_s *cm, rpmfi fi,
+			     const char *path, const char *suffix)
+{
+    return (cm->enabled && suffix &&
+	    !(S_ISSOCK(rpmfiFMode(fi)) && IS_DEV_LOG(path)));
+}
+
+static void committerQueue(struct committer_s *cm, int dirfd, rpmfi fi,
+			   const char *path, rpmFileAction action)
+{
+    const char *nsuffix = (action == FA_ALTNAME) ? SUFFIX_RPMNEW : NULL;
+    char *dest = fsmFsPath(fi, nsuffix);
+
+    removeSBITS(dirfd, dest);
+#ifdef WITH_LIBURING
+    /* If the ring is full, the entry is renamed synchronously on flush */
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&cm->ring);
+    if (sqe) {
+	io_uring_prep_renameat(sqe, dirfd, path, dirfd, dest, 0);
+	io_uring_sqe_set_data64(sqe, cm->pending.size());
+	cm->nqueued++;
+    }
+#endif
+    cm->pending.push_back({rpmfiFX(fi), dirfd, dest});
+}
+
+/*
+ * Submit queued renames and wait for them to complete, then finish up
+ * the files in order just like the synchronous path does. Renames the
+ * ring could not carry out, eg. due to io_uring being blocked at runtime,
+ * are done synchronously instead.
+ */
+static int committerFlush(struct committer_s *cm, rpmfiles files,
+			  struct filedata_s *fdata, rpmPlugins plugins,
+			  char **failedFile)
+{
+    int rc = 0;
+    int n = cm->pending.size();
+    std::vector<int> results(n, -ECANCELED);	/* -errno, -ECANCELED if not done */
+    rpmfi fi = NULL;
+
+    if (n == 0)
+	goto exit;
+
+#ifdef WITH_LIBURING
+    if (cm->nqueued > 0) {
+	struct io_uring_cqe *cqe;
+	int nqueued = cm->nqueued;
+	int nsubmit = io_uring_submit_and_wait(&cm->ring, nqueued);
+	for (int i = 0; i < nsubmit && io_uring_wait_cqe(&cm->ring, &cqe) == 0; i++) {
+	    results[io_uring_cqe_get_data64(cqe)] = cqe->res;
+	    io_uring_cqe_seen(&cm->ring, cqe);
+	}
+	cm->nqueued = 0;
+	/* Don't leave stale entries behind, stop using the ring instead */
+	if (nsubmit < nqueued)
+	    committerFini(cm);
+    }
+#endif
+
+    for (int i = 0; i < n; i++) {
+	int res = results[i];
+	if (res == -ECANCELED || res == -EINVAL || res == -ENOSYS ||
+	    res == -EOPNOTSUPP) {
+	    auto & ce = cm->pending[i];
+	    if (renameat(ce.dirfd, fdata[ce.fx].fpath, ce.dirfd, ce.dest))
+		results[i] = -errno;
+	    else
+		results[i] = 0;
+	    /* Renames aren't supported by the ring, don't bother further */
+	    if (res != -ECANCELED)
+		committerFini(cm);
+	}
+    }
+
+    fi = rpmfilesIter(files, RPMFI_ITER_FWD);
+    for (int i = 0; i < n; i++) {
+	int fx = cm->pending[i].fx;
+	char *dest = cm->pending[i].dest;
+	struct filedata_s *fp = &fdata[fx];
+	int frc = 0;
+
+	rpmfiSetFX(fi, fx);
+	if (_fsm_debug)
+	    rpmlog(RPMLOG_DEBUG, " %8s (%s, %s) %s\n", __func__,
+		   fp->fpath, dest, (results[i] < 0 ? strerror(-results[i]) : ""));
+
+	if (results[i] < 0) {
+	    frc = (results[i] == -EISDIR) ?
+		    RPMERR_EXIST_AS_DIR : RPMERR_RENAME_FAILED;
+	    free(dest);
+	    if (!rc)
+		rc = frc;
+	    if (*failedFile == NULL)
+		*failedFile = rstrscat(NULL, rpmfiDN(fi), fp->fpath, NULL);
+	} else {
+	    if (fp->action == FA_ALTNAME) {
+		char * opath = fsmFsPath(fi, NULL);
+		rpmlog(RPMLOG_WARNING, _("%s%s created as %s%s\n"),
+		       rpmfiDN(fi), opath, rpmfiDN(fi), dest);
+		free(opath);
+	    }
+	    free(fp->fpath);
+	    fp->fpath = dest;
+	    fp->stage = FILE_COMMIT;
+	}
+
+	/* Run fsm file post hook for all plugins for all processed files */
+	rpmpluginsCallFsmFilePost(plugins, fi, fp->fpath,
+				  fp->sb.st_mode, fp->action, frc);
+    }
+    rpmfiFree(fi);
+    cm->pending.clear();
+
+exit:
+    return rc;
+}
+
 /**
  * Return formatted string representation of file disposition.
  * @param a		file disposition
@@ -886,13 +1184,23 @@ int rpmPackageFilesInstall(rpmts ts, rpmte te, rpmfiles files,
     int rc = 0;
     int fx = -1;
     int fc = rpmfilesFC(files);
-    int nodigest = (rpmtsFlags(ts) & RPMTRANS_FLAG_NOFILEDIGEST) ? 1 : 0;
     int nofcaps = (rpmtsFlags(ts) & RPMTRANS_FLAG_NOCAPS) ? 1 : 0;
     int firstlinkfile = -1;
     char *tid = NULL;
     struct filedata_s *fdata = (struct filedata_s *)xcalloc(fc, sizeof(*fdata));
     struct filedata_s *firstlink = NULL;
     struct diriter_s di = { -1, -1 };
+    struct unpacker_s up = {};
+    struct committer_s cm = {};
+
+    up.nodigest = (rpmtsFlags(ts) & RPMTRANS_FLAG_NOFILEDIGEST) ? 1 : 0;
+    /* Without an owner psm, we're part of a concurrently unpacked batch */
+    up.parallel = (psm == NULL);
+#ifdef ENABLE_OPENMP
+    up.nthreads = rpmExpandNumeric("%{?_unpack_nthreads}");
+#endif
+    if (up.nthreads < 1)
+	up.nthreads = 1;
 
     /* transaction id used for temporary path suffix while installing */
     rasprintf(&tid, ";%08x", (unsigned)rpmtsGetTid(ts));
@@ -935,8 +1243,14 @@ int rpmPackageFilesInstall(rpmts ts, rpmte te, rpmfiles files,
         goto exit;
     }
 
-    /* Process the payload */
-    while (!rc && (fx = rpmfiNext(fi)) >= 0) {
+    /*
+     * Process the payload. With writer threads enabled, the payload is
+     * decompressed on this thread while regular file contents are written
+     * and digested by the others, metadata of such files is set on commit.
+     */
+    #pragma omp parallel num_threads(up.nthreads) if (up.nthreads > 1)
+    #pragma omp master
+    while (!rc && !up.failed && (fx = rpmfiNext(fi)) >= 0) {
 	struct filedata_s *fp = &fdata[fx];
 
 	/*
@@ -952,7 +1266,8 @@ int rpmPackageFilesInstall(rpmts ts, rpmte te, rpmfiles files,
 	    int mayopen = 0;
 	    int fd = -1;
 	    rc = ensureDir(plugins, rpmfiDN(fi), 0,
-			    (fp->action == FA_CREATE), 0, &di.dirfd);
+			    (fp->action == FA_CREATE), up.parallel, 0,
+			    &di.dirfd);
 
 	    /* Directories replacing something need early backup */
 	    if (!rc && !fp->suffix && fp != firstlink) {
@@ -992,7 +1307,7 @@ int rpmPackageFilesInstall(rpmts ts, rpmte te, rpmfiles files,
 
             if (S_ISREG(fp->sb.st_mode)) {
 		if (rc == RPMERR_ENOENT) {
-		    rc = fsmMkfile(di.dirfd, fi, fp, files, psm, nodigest,
+		    rc = fsmMkfile(di.dirfd, fi, fp, files, psm, &up,
 				   &firstlink, &firstlinkfile, &di.firstdir,
 				   &fd);
 		}
@@ -1002,6 +1317,10 @@ int rpmPackageFilesInstall(rpmts ts, rpmte te, rpmfiles files,
                     mode &= ~07777;
                     mode |=  00700;
                     rc = fsmMkdir(di.dirfd, fp->fpath, mode);
+		    /* Created by a parallel install, setmeta checks the type */
+		    if (up.parallel && rc == RPMERR_MKDIR_FAILED &&
+			    errno == EEXIST)
+			rc = 0;
                 }
             } else if (S_ISLNK(fp->sb.st_mode)) {
 		if (rc == RPMERR_ENOENT) {
@@ -1028,6 +1347,8 @@ int rpmPackageFilesInstall(rpmts ts, rpmte te, rpmfiles files,
 setmeta:
 	    /* Special files require path-based ops */
 	    mayopen = S_ISREG(fp->sb.st_mode) || S_ISDIR(fp->sb.st_mode);
+	    if (fp->deferred)
+		mayopen = 0;
 	    if (!rc && fd == -1 && mayopen) {
 		int flags = O_RDONLY;
 		/* Only follow safe symlinks, and never on temporary files */
@@ -1037,7 +1358,7 @@ setmeta:
 				S_ISDIR(fp->sb.st_mode));
 	    }
 
-	    if (!rc && fp->setmeta) {
+	    if (!rc && fp->setmeta && !fp->deferred) {
 		rc = fsmSetmeta(fd, di.dirfd, fp->fpath,
 				fi, plugins, fp->action,
 				&fp->sb, nofcaps);
@@ -1056,35 +1377,85 @@ setmeta:
     }
     fi = fsmIterFini(fi, &di);
 
+    /* Pick up the first writer failure, if any */
+    for (int i = 0; up.failed && i < fc; i++) {
+	struct filedata_s *fp = &fdata[i];
+	if (fp->wrc) {
+	    if (!rc) {
+		rc = fp->wrc;
+		*failedFile = rstrscat(NULL,
+			    rpmfilesDN(files, rpmfilesDI(files, i)),
+			    fp->fpath, NULL);
+	    }
+	    break;
+	}
+    }
+
     if (!rc && fx < 0 && fx != RPMERR_ITER_END)
 	rc = fx;
 
     /* If all went well, commit files to final destination */
+    committerInit(&cm);
     fi = fsmIter(NULL, files, RPMFI_ITER_FWD, &di);
     while (!rc && (fx = rpmfiNext(fi)) >= 0) {
 	struct filedata_s *fp = &fdata[fx];
 
 	if (!fp->skip) {
 	    if (!rc)
-		rc = ensureDir(NULL, rpmfiDN(fi), 0, 0, 0, &di.dirfd);
+		rc = ensureDir(NULL, rpmfiDN(fi), 0, 0, 0, 0, &di.dirfd);
+
+	    /*
+	     * Set metadata of files written by writer threads. They were
+	     * created write-only, and the writer already flushed them so
+	     * don't go through fsmClose() again.
+	     */
+	    if (!rc && fp->deferred && fp->setmeta) {
+		int fd = -1;
+		rc = fsmOpenat(&fd, di.dirfd, fp->fpath,
+				O_WRONLY|O_NOFOLLOW, 0);
+		if (!rc) {
+		    rc = fsmSetmeta(fd, di.dirfd, fp->fpath,
+				    fi, plugins, fp->action,
+				    &fp->sb, nofcaps);
+		    if (close(fd) && !rc)
+			rc = RPMERR_CLOSE_FAILED;
+		}
+	    }
 
 	    /* Backup file if needed. Directories are handled earlier */
 	    if (!rc && fp->suffix)
 		rc = fsmBackup(di.dirfd, fi, fp->action);
 
-	    if (!rc)
-		rc = fsmCommit(di.dirfd, &fp->fpath, fi, fp->action, fp->suffix);
+	    if (!rc && committerCanQueue(&cm, fi, fp->fpath, fp->suffix)) {
+		committerQueue(&cm, di.dirfd, fi, fp->fpath, fp->action);
+	    } else {
+		if (!rc)
+		    rc = fsmCommit(di.dirfd, &fp->fpath, fi, fp->action, fp->suffix);
 
-	    if (!rc)
-		fp->stage = FILE_COMMIT;
-	    else
-		*failedFile = rstrscat(NULL, rpmfiDN(fi), fp->fpath, NULL);
+		if (!rc)
+		    fp->stage = FILE_COMMIT;
+		else
+		    *failedFile = rstrscat(NULL, rpmfiDN(fi), fp->fpath, NULL);
+
+		/* Run fsm file post hook for all plugins for all processed files */
+		rpmpluginsCallFsmFilePost(plugins, fi, fp->fpath,
+					  fp->sb.st_mode, fp->action, rc);
+	    }
+	}
 
-	    /* Run fsm file post hook for all plugins for all processed files */
-	    rpmpluginsCallFsmFilePost(plugins, fi, fp->fpath,
-				      fp->sb.st_mode, fp->action, rc);
+	/* Flush queued renames before leaving the directory */
+	if (!rc && !cm.pending.empty() &&
+		(cm.pending.size() >= COMMIT_BATCH || fx + 1 >= fc ||
+		 rpmfilesDI(files, fx + 1) != rpmfiDX(fi))) {
+	    rc = committerFlush(&cm, files, fdata, plugins, failedFile);
 	}
     }
+    if (!cm.pending.empty()) {
+	int crc = committerFlush(&cm, files, fdata, plugins, failedFile);
+	if (!rc)
+	    rc = crc;
+    }
+    committerFini(&cm);
     fi = fsmIterFini(fi, &di);
 
     /* On failure, walk backwards and erase non-committed files */
@@ -1094,7 +1465,7 @@ setmeta:
 	    struct filedata_s *fp = &fdata[fx];
 
 	    /* If the directory doesn't exist there's nothing to clean up */
-	    if (ensureDir(NULL, rpmfiDN(fi), 0, 0, 1, &di.dirfd))
+	    if (ensureDir(NULL, rpmfiDN(fi), 0, 0, 0, 1, &di.dirfd))
 		continue;
 
 	    if (fp->stage > FILE_NONE && !fp->skip && fp->action != FA_TOUCH) {
@@ -1103,8 +1474,12 @@ setmeta:
 	}
     }
 
+    /* Packages may be getting installed in parallel */
+    #pragma omp critical (rpmtsop)
+    {
     rpmswAdd(rpmtsOp(ts, RPMTS_OP_UNCOMPRESS), fdOp(payload, FDSTAT_READ));
     rpmswAdd(rpmtsOp(ts, RPMTS_OP_DIGEST), fdOp(payload, FDSTAT_DIGEST));
+    }
 
 exit:
     fi = fsmIterFini(fi, &di);
@@ -1139,7 +1514,7 @@ int rpmPackageFilesRemove(rpmts ts, rpmte te, rpmfiles files,
 
 	fp->fpath = fsmFsPath(fi, NULL);
 	/* If the directory doesn't exist there's nothing to clean up */
-	if (ensureDir(NULL, rpmfiDN(fi), 0, 0, 1, &di.dirfd))
+	if (ensureDir(NULL, rpmfiDN(fi), 0, 0, 0, 1, &di.dirfd))
 	    continue;
 
 	rc = fsmStat(di.dirfd, fp->fpath, 1, &fp->sb);
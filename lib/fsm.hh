@@ -16,7 +16,7 @@ typedef struct rpmpsm_s * rpmpsm;
  * @param ts		transaction set
  * @param te		transaction set element
  * @param files		transaction element file info
- * @param psm		owner psm (or NULL)
+ * @param psm		owner psm (or NULL when unpacking concurrently with others)
  * @param[out] failedFile	pointer to first file name that failed (malloced)
  * @return		0 on success
  */
@@ -35,4 +35,11 @@ int rpmfiArchiveReadToFilePsm(rpmfi fi, FD_t fd, int nodigest, rpmpsm psm);
 RPM_GNUC_INTERNAL
 void rpmpsmNotify(rpmpsm psm, rpmCallbackType what, rpm_loff_t amount);
 
+/**
+ * Return the %_flush_io setting, read once per process.
+ * @return		0 (off), 1 (per file) or 2 (batched per package)
+ */
+RPM_GNUC_INTERNAL
+int rpmfsmFlushIO(void);
+
 #endif	/* H_FSM */
@@ -872,6 +872,48 @@ static bool singleSprintf(headerSprintfArgs hsa, sprintfToken token,
     return false;
 }
 
+static void formatTags(sprintfToken format, int num,
+		       std::vector<rpmTagVal> & tags)
+{
+    for (int i = 0; i < num; i++) {
+	switch (format[i].type) {
+	case PTOK_TAG:
+	    tags.push_back(format[i].u.tag.tag);
+	    break;
+	case PTOK_ARRAY:
+	    formatTags(format[i].u.array.format,
+		       format[i].u.array.numTokens, tags);
+	    break;
+	case PTOK_COND:
+	    tags.push_back(format[i].u.cond.tag.tag);
+	    formatTags(format[i].u.cond.ifFormat,
+		       format[i].u.cond.numIfTokens, tags);
+	    formatTags(format[i].u.cond.elseFormat,
+		       format[i].u.cond.numElseTokens, tags);
+	    break;
+	case PTOK_NONE:
+	case PTOK_STRING:
+	default:
+	    break;
+	}
+    }
+}
+
+int headerFormatTags(const char * fmt, std::vector<rpmTagVal> & tags)
+{
+    struct headerSprintfArgs_s hsa {};
+    int rc = -1;
+
+    hsa.fmt = xstrdup(fmt);
+    if (!parseFormat(&hsa, hsa.fmt, &hsa.format, &hsa.numTokens, NULL, PARSER_BEGIN)) {
+	formatTags(hsa.format, hsa.numTokens, tags);
+	hsa.format = freeFormat(hsa.format, hsa.numTokens);
+	rc = 0;
+    }
+    hsa.fmt = _free(hsa.fmt);
+    return rc;
+}
+
 char * headerFormat(Header h, const char * fmt, errmsg_t * errmsg) 
 {
     struct headerSprintfArgs_s hsa {};
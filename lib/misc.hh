@@ -7,6 +7,7 @@
  */
 
 #include <string.h>
+#include <vector>
 #include <rpm/rpmtypes.h>
 #include <rpm/header.h>		/* for headerGetFlags typedef, duh.. */
 #include "rpmfs.hh"
@@ -23,6 +24,15 @@ char * rpmVerifyString(uint32_t verifyResult, const char *pad);
 RPM_GNUC_INTERNAL
 char * rpmFFlagsString(uint32_t fflags);
 
+/* Verify iterator packages, checking files on up to nthreads threads */
+RPM_GNUC_INTERNAL
+int rpmcliVerifyForeach(struct rpmQVKArguments_s * qva, rpmts ts,
+			rpmdbMatchIterator mi, int nthreads);
+
+/* Return a malloced, quoted JSON string literal for s */
+RPM_GNUC_INTERNAL
+char * rpmJsonEscape(const char *s);
+
 typedef int (*headerTagTagFunction) (Header h, rpmtd td, headerGetFlags hgflags);
 
 RPM_GNUC_INTERNAL
@@ -37,6 +47,10 @@ headerFmt rpmHeaderFormatByValue(rpmtdFormats fmt);
 RPM_GNUC_INTERNAL
 char * rpmHeaderFormatCall(headerFmt fmt, rpmtd td);
 
+/* Collect the tags referenced by a query format, -1 on parse error */
+RPM_GNUC_INTERNAL
+int headerFormatTags(const char * fmt, std::vector<rpmTagVal> & tags);
+
 RPM_GNUC_INTERNAL
 int headerFindSpec(Header h);
 
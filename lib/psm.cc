@@ -7,6 +7,10 @@
 
 #include <errno.h>
 #include <atomic>
+#include <vector>
+#ifdef ENABLE_OPENMP
+#include <omp.h>
+#endif
 
 #include <rpm/rpmlib.h>		/* rpmvercmp and others */
 #include <rpm/rpmmacro.h>
@@ -745,7 +749,9 @@ static rpmRC dbAdd(rpmts ts, rpmte te)
 	mergeAux(auxh, h);
 
     (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_DBADD), 0);
+    (void) rpmswEnter(rpmteOp(te, RPMTE_OP_DBADD), 0);
     rc = (rpmdbAdd(rpmtsGetRdb(ts), h) == 0) ? RPMRC_OK : RPMRC_FAIL;
+    (void) rpmswExit(rpmteOp(te, RPMTE_OP_DBADD), 0);
     (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_DBADD), 0);
 
     if (rc == RPMRC_OK) {
@@ -762,8 +768,10 @@ static rpmRC dbRemove(rpmts ts, rpmte te)
     rpmRC rc;
 
     (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_DBREMOVE), 0);
+    (void) rpmswEnter(rpmteOp(te, RPMTE_OP_DBREMOVE), 0);
     rc = (rpmdbRemove(rpmtsGetRdb(ts), rpmteDBInstance(te)) == 0) ?
 						RPMRC_OK : RPMRC_FAIL;
+    (void) rpmswExit(rpmteOp(te, RPMTE_OP_DBREMOVE), 0);
     (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_DBREMOVE), 0);
 
     if (rc == RPMRC_OK)
@@ -771,24 +779,33 @@ static rpmRC dbRemove(rpmts ts, rpmte te)
     return rc;
 }
 
-static rpmRC rpmpsmUnpack(rpmpsm psm)
+static void rpmpsmUnpackStart(rpmpsm psm)
 {
-    char *failedFile = NULL;
-    int fsmrc = 0;
-    int saved_errno = 0;
-    rpmRC rc = RPMRC_OK;
-
     rpmpsmNotify(psm, RPMCALLBACK_INST_START, 0);
     /* make sure first progress call gets made */
     rpmpsmNotify(psm, RPMCALLBACK_INST_PROGRESS, 0);
+}
 
-    if (!(rpmtsFlags(psm->ts) & RPMTRANS_FLAG_JUSTDB)) {
-	if (rpmfilesFC(psm->files) > 0) {
-	    fsmrc = rpmPackageFilesInstall(psm->ts, psm->te, psm->files,
-				   psm, &failedFile);
-	    saved_errno = errno;
+static int rpmpsmUnpackFiles(rpmts ts, rpmte te, rpmfiles files, rpmpsm psm,
+			     char **failedFile, int *saved_errno)
+{
+    int fsmrc = 0;
+
+    if (!(rpmtsFlags(ts) & RPMTRANS_FLAG_JUSTDB)) {
+	if (rpmfilesFC(files) > 0) {
+	    (void) rpmswEnter(rpmteOp(te, RPMTE_OP_UNPACK), 0);
+	    fsmrc = rpmPackageFilesInstall(ts, te, files, psm, failedFile);
+	    *saved_errno = errno;
+	    (void) rpmswExit(rpmteOp(te, RPMTE_OP_UNPACK), 0);
 	}
     }
+    return fsmrc;
+}
+
+static rpmRC rpmpsmUnpackFinish(rpmpsm psm, int fsmrc, int saved_errno,
+				const char *failedFile)
+{
+    rpmRC rc = RPMRC_OK;
 
     /* XXX make sure progress reaches 100% */
     rpmpsmNotify(psm, RPMCALLBACK_INST_PROGRESS, psm->total);
@@ -809,6 +826,21 @@ static rpmRC rpmpsmUnpack(rpmpsm psm)
 	/* XXX notify callback on error. */
 	rpmtsNotify(psm->ts, psm->te, RPMCALLBACK_UNPACK_ERROR, 0, 0);
     }
+    return rc;
+}
+
+static rpmRC rpmpsmUnpack(rpmpsm psm)
+{
+    char *failedFile = NULL;
+    int fsmrc = 0;
+    int saved_errno = 0;
+    rpmRC rc = RPMRC_OK;
+
+    rpmpsmUnpackStart(psm);
+    fsmrc = rpmpsmUnpackFiles(psm->ts, psm->te, psm->files, psm,
+			      &failedFile, &saved_errno);
+    rc = rpmpsmUnpackFinish(psm, fsmrc, saved_errno, failedFile);
+
     free(failedFile);
     return rc;
 }
@@ -825,8 +857,10 @@ static rpmRC rpmpsmRemove(rpmpsm psm)
     /* XXX should't we log errors from here? */
     if (!(rpmtsFlags(psm->ts) & RPMTRANS_FLAG_JUSTDB)) {
 	if (rpmfilesFC(psm->files) > 0) {
+	    (void) rpmswEnter(rpmteOp(psm->te, RPMTE_OP_ERASE), 0);
 	    fsmrc = rpmPackageFilesRemove(psm->ts, psm->te, psm->files,
 					  psm, &failedFile);
+	    (void) rpmswExit(rpmteOp(psm->te, RPMTE_OP_ERASE), 0);
 	}
     }
     /* XXX make sure progress reaches 100% */
@@ -837,12 +871,12 @@ static rpmRC rpmpsmRemove(rpmpsm psm)
     return (fsmrc == 0) ? RPMRC_OK : RPMRC_FAIL;
 }
 
-static rpmRC rpmPackageInstall(rpmts ts, rpmpsm psm)
+/* Install steps preceding the payload unpack */
+static rpmRC rpmPackageInstallPre(rpmts ts, rpmpsm psm)
 {
     rpmRC rc = RPMRC_OK;
     int once = 1;
 
-    rpmswEnter(rpmtsOp(psm->ts, RPMTS_OP_INSTALL), 0);
     while (once--) {
 	/* HACK: replacepkgs abuses te instance to remove old header */
 	if (rpmtsFilterFlags(psm->ts) & RPMPROB_FILTER_REPLACEPKG)
@@ -868,15 +902,26 @@ static rpmRC rpmPackageInstall(rpmts ts, rpmpsm psm)
 	    rc = runInstScript(psm, RPMTAG_PREIN);
 	    if (rc) break;
 	}
+    }
 
-	rc = rpmChrootIn() ? RPMRC_FAIL : RPMRC_OK;
-	if (rc == RPMRC_OK) {
-	    rc = rpmpsmUnpack(psm);
-	    rpmChrootOut();
-	}
-	if (rc) break;
+    return rc;
+}
+
+/* Install steps following the payload unpack */
+static rpmRC rpmPackageInstallPost(rpmts ts, rpmpsm psm)
+{
+    rpmRC rc = RPMRC_OK;
+    int once = 1;
 
+    while (once--) {
 	if (!(rpmtsFlags(ts) & RPMTRANS_FLAG_NODB)) {
+	    /* In batched flush mode, get the files on disk before the rpmdb */
+	    if (rpmfsmFlushIO() > 1 && !(rpmtsFlags(ts) & RPMTRANS_FLAG_JUSTDB)) {
+		(void) rpmswEnter(rpmteOp(psm->te, RPMTE_OP_SYNC), 0);
+		rpmtsSync(ts);
+		(void) rpmswExit(rpmteOp(psm->te, RPMTE_OP_SYNC), 0);
+	    }
+
 	    /*
 	     * If this package has already been installed, remove it from
 	     * the database before adding the new one.
@@ -932,6 +977,28 @@ static rpmRC rpmPackageInstall(rpmts ts, rpmpsm psm)
 	rc = markReplacedFiles(psm);
     }
 
+    return rc;
+}
+
+static rpmRC rpmPackageInstall(rpmts ts, rpmpsm psm)
+{
+    rpmRC rc = RPMRC_OK;
+
+    rpmswEnter(rpmtsOp(psm->ts, RPMTS_OP_INSTALL), 0);
+
+    rc = rpmPackageInstallPre(ts, psm);
+
+    if (rc == RPMRC_OK) {
+	rc = rpmChrootIn() ? RPMRC_FAIL : RPMRC_OK;
+	if (rc == RPMRC_OK) {
+	    rc = rpmpsmUnpack(psm);
+	    rpmChrootOut();
+	}
+    }
+
+    if (rc == RPMRC_OK)
+	rc = rpmPackageInstallPost(ts, psm);
+
     rpmswExit(rpmtsOp(psm->ts, RPMTS_OP_INSTALL), 0);
 
     return rc;
@@ -1134,3 +1201,66 @@ rpmRC rpmpsmRun(rpmts ts, rpmte te, pkgGoal goal)
     rpmpsmFree(psm);
     return rc;
 }
+
+void rpmpsmRunInstalls(rpmts ts, rpmte *tes, rpmRC *rcs, int n, int nthreads)
+{
+    std::vector<rpmpsm> psms(n);
+    std::vector<char *> failedFiles(n);
+    std::vector<int> fsmrcs(n);
+    std::vector<int> errnos(n);
+    int chrooted = 0;
+
+    /* Everything up to the unpack happens in transaction order */
+    for (int i = 0; i < n; i++) {
+	if (rcs[i])
+	    continue;
+	psms[i] = rpmpsmNew(ts, tes[i], PKG_INSTALL);
+	if (rpmChrootIn() == 0) {
+	    rcs[i] = rpmpluginsCallPsmPre(rpmtsPlugins(ts), tes[i]);
+	    rpmChrootOut();
+	}
+	if (!rcs[i])
+	    rcs[i] = rpmPackageInstallPre(ts, psms[i]);
+	if (!rcs[i])
+	    rpmpsmUnpackStart(psms[i]);
+    }
+
+    /*
+     * The elements have no scriptlets or triggers and the transaction
+     * has already sorted out their file overlaps, so their payloads
+     * can be laid down concurrently. Callbacks are not thread-safe,
+     * progress is only reported once each element is done.
+     */
+    rpmswEnter(rpmtsOp(ts, RPMTS_OP_INSTALL), 0);
+    chrooted = (rpmChrootIn() == 0);
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads) if (chrooted)
+    for (int i = 0; i < n; i++) {
+	if (rcs[i] || !chrooted)
+	    continue;
+	fsmrcs[i] = rpmpsmUnpackFiles(ts, tes[i], psms[i]->files, NULL,
+				      &failedFiles[i], &errnos[i]);
+    }
+    if (chrooted)
+	rpmChrootOut();
+    rpmswExit(rpmtsOp(ts, RPMTS_OP_INSTALL), 0);
+
+    /* ...and so does everything after it, including rpmdb updates */
+    for (int i = 0; i < n; i++) {
+	if (psms[i] == NULL)
+	    continue;
+	if (!rcs[i] && !chrooted)
+	    rcs[i] = RPMRC_FAIL;
+	if (!rcs[i])
+	    rcs[i] = rpmpsmUnpackFinish(psms[i], fsmrcs[i], errnos[i],
+					failedFiles[i]);
+	if (!rcs[i])
+	    rcs[i] = rpmPackageInstallPost(ts, psms[i]);
+
+	if (rpmChrootIn() == 0) {
+	    rpmpluginsCallPsmPost(rpmtsPlugins(ts), tes[i], rcs[i]);
+	    rpmChrootOut();
+	}
+	free(failedFiles[i]);
+	rpmpsmFree(psms[i]);
+    }
+}
@@ -6,6 +6,7 @@
 #include "system.h"
 
 #include <string>
+#include <vector>
 
 #include <errno.h>
 #include <inttypes.h>
@@ -22,7 +23,9 @@
 #include <rpm/rpmstring.h>
 
 #include "rpmgi.hh"
+#include "rpmdb_internal.hh"
 #include "manifest.hh"
+#include "misc.hh"
 
 #include "debug.h"
 
@@ -279,14 +282,71 @@ static int rpmgiShowMatches(QVA_t qva, rpmts ts, rpmgi gi)
     return ec + rpmgiNumErrors(gi);
 }
 
+struct queryResult_s {
+    char *str;
+    const char *errstr;
+};
+
+/* Formatting only looks at the header, so it can run in parallel */
+static int queryFormatFunc(Header h, void *data, void **result)
+{
+    QVA_t qva = (QVA_t)data;
+    struct queryResult_s *res = new queryResult_s {};
+
+    res->str = headerFormat(h, qva->qva_queryFormat, &res->errstr);
+    *result = res;
+    return 0;
+}
+
+static int queryFormatEmit(Header h, void *result, void *data)
+{
+    struct queryResult_s *res = (struct queryResult_s *)result;
+
+    if (res->str != NULL) {
+	rpmlog(RPMLOG_NOTICE, "%s", res->str);
+	free(res->str);
+    } else {
+	rpmlog(RPMLOG_ERR, _("incorrect format: %s\n"), res->errstr);
+    }
+    delete res;
+    return 0;
+}
+
+/* Is this a query that only outputs a --queryformat per package? */
+static int isFormatQuery(QVA_t qva)
+{
+    return (qva->qva_showPackage == showQueryPackage &&
+	    qva->qva_queryFormat != NULL && !qva->qva_incattr &&
+	    !(qva->qva_flags & QUERY_FOR_LIST));
+}
+
 static int rpmcliShowMatches(QVA_t qva, rpmts ts, rpmdbMatchIterator mi)
 {
     Header h;
     int ec = 0;
+    int nthreads;
 
     if (mi == NULL)
 	return 1;
 
+    /* Use package summaries if they have all the tags of the format */
+    if (isFormatQuery(qva)) {
+	std::vector<rpmTagVal> tags;
+	if (headerFormatTags(qva->qva_queryFormat, tags) == 0)
+	    rpmdbSetIteratorSummary(mi, tags.data(), tags.size());
+    }
+
+    nthreads = rpmExpandNumeric("%{?_query_nthreads}");
+    if (nthreads > 1) {
+	if (qva->qva_showPackage == showVerifyPackage)
+	    return rpmcliVerifyForeach(qva, ts, mi, nthreads);
+	/* i18n tag lookups switch the environment around, not thread safe */
+	if (isFormatQuery(qva) && !rpmExpandNumeric("%{?_i18ndomains:1}")) {
+	    return rpmdbForeachIterator(mi, nthreads, queryFormatFunc,
+					queryFormatEmit, qva);
+	}
+    }
+
     while ((h = rpmdbNextIterator(mi)) != NULL) {
 	int rc;
 	if ((rc = qva->qva_showPackage(qva, ts, h)) != 0)
@@ -4,12 +4,16 @@
 
 #include "system.h"
 
+#include <algorithm>
+#include <numeric>
 #include <unordered_map>
+#include <vector>
 
 #include <rpm/rpmte.h>
 #include <rpm/rpmfi.h>
 #include <rpm/rpmstring.h>
 #include <rpm/rpmstrpool.h>
+#include <rpm/rpmver.h>
 
 #include "rpmal.hh"
 #include "misc.hh"
@@ -49,13 +53,31 @@ typedef struct availableIndexFileEntry_s {
 using rpmalDepHash = std::unordered_multimap<rpmsid,availableIndexEntry_s>;
 using rpmalFileHash = std::unordered_multimap<rpmsid,availableIndexFileEntry_s>;
 
+/** \ingroup rpmdep
+ * Provides of the available packages as parallel arrays sorted by name,
+ * with the versions parsed up front for comparing against dependencies.
+ */
+struct rpmalProvidesIndex {
+    std::vector<rpmsid> name;		/*!< Provide name ids (sorted). */
+    std::vector<rpmalNum> pkgNum;	/*!< Containing package indexes. */
+    std::vector<unsigned int> entryIx;	/*!< Dependency indexes. */
+    std::vector<rpmsenseFlags> flags;	/*!< Provide flags. */
+    std::vector<rpmver> evr;		/*!< Parsed versions, NULL if none. */
+    size_t nsorted = 0;			/*!< No. of entries in sorted order. */
+
+    ~rpmalProvidesIndex() {
+	for (auto v : evr)
+	    rpmverFree(v);
+    }
+};
+
 /** \ingroup rpmdep
  * Set of available packages, items, and directories.
  */
 struct rpmal_s {
     rpmstrPool pool;		/*!< String pool */
     std::vector<availablePackage_s> list;/*!< Set of packages. */
-    rpmalDepHash *providesHash;
+    rpmalProvidesIndex *providesIndex;
     rpmalDepHash *obsoletesHash;
     rpmalFileHash *fileHash;
     rpmtransFlags tsflags;	/*!< Transaction control flags. */
@@ -70,7 +92,7 @@ struct rpmal_s {
  */
 static void rpmalFreeIndex(rpmal al)
 {
-    delete al->providesHash;
+    delete al->providesIndex;
     delete al->obsoletesHash;
     delete al->fileHash;
     al->fpc = fpCacheFree(al->fpc);
@@ -152,28 +174,70 @@ static void rpmalAddFiles(rpmal al, rpmalNum pkgNum, rpmfiles fi)
 
 static void rpmalAddProvides(rpmal al, rpmalNum pkgNum, rpmds provides)
 {
-    struct availableIndexEntry_s indexEntry;
+    rpmalProvidesIndex *pi = al->providesIndex;
     rpm_color_t dscolor;
     int skipconf = (al->tsflags & RPMTRANS_FLAG_NOCONFIGS);
     int dc = rpmdsCount(provides);
 
-    indexEntry.pkgNum = pkgNum;
-
     for (int i = 0; i < dc; i++) {
+	rpmsenseFlags flags = rpmdsFlagsIndex(provides, i);
+	const char *evr = rpmdsEVRIndex(provides, i);
+
         /* Ignore colored provides not in our rainbow. */
         dscolor = rpmdsColorIndex(provides, i);
         if (al->tscolor && dscolor && !(al->tscolor & dscolor))
             continue;
 
 	/* Ignore config() provides if the files wont be installed */
-	if (skipconf & (rpmdsFlagsIndex(provides, i) & RPMSENSE_CONFIG))
+	if (skipconf & (flags & RPMSENSE_CONFIG))
 	    continue;
 
-	indexEntry.entryIx = i;;
-	al->providesHash->insert({rpmdsNIdIndex(provides, i), indexEntry});
+	pi->name.push_back(rpmdsNIdIndex(provides, i));
+	pi->pkgNum.push_back(pkgNum);
+	pi->entryIx.push_back(i);
+	pi->flags.push_back(flags);
+	pi->evr.push_back((flags & RPMSENSE_SENSEMASK) && evr && *evr ?
+			  rpmverParse(evr) : NULL);
     }
 }
 
+template <typename T>
+static void permute(std::vector<T> & v, const std::vector<size_t> & order)
+{
+    std::vector<T> sorted;
+    sorted.reserve(order.size());
+    for (auto i : order)
+	sorted.push_back(v[i]);
+    v.swap(sorted);
+}
+
+/**
+ * Sort provides added since the last lookup into the index.
+ * @param al		available list
+ */
+static void rpmalSortProvides(rpmal al)
+{
+    rpmalProvidesIndex *pi = al->providesIndex;
+    size_t n = pi->name.size();
+
+    if (pi->nsorted == n)
+	return;
+
+    /* Stable to keep the providers of a name in package order */
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [pi](size_t a, size_t b) {
+	return pi->name[a] < pi->name[b];
+    });
+
+    permute(pi->name, order);
+    permute(pi->pkgNum, order);
+    permute(pi->entryIx, order);
+    permute(pi->flags, order);
+    permute(pi->evr, order);
+    pi->nsorted = n;
+}
+
 static void rpmalAddObsoletes(rpmal al, rpmalNum pkgNum, rpmds obsoletes)
 {
     struct availableIndexEntry_s indexEntry;
@@ -211,7 +275,7 @@ void rpmalAdd(rpmal al, rpmte p)
     al->list.push_back(alp);
 
     /* Try to be lazy as delayed hash creation is cheaper */
-    if (al->providesHash != NULL)
+    if (al->providesIndex != NULL)
 	rpmalAddProvides(al, pkgNum, alp.provides);
     if (al->obsoletesHash != NULL)
 	rpmalAddObsoletes(al, pkgNum, alp.obsoletes);
@@ -242,12 +306,18 @@ static void rpmalMakeProvidesIndex(rpmal al)
 	providesCnt += rpmdsCount(alp.provides);
     }
 
-    al->providesHash = new rpmalDepHash(providesCnt/4+128);
+    al->providesIndex = new rpmalProvidesIndex {};
+    al->providesIndex->name.reserve(providesCnt);
+    al->providesIndex->pkgNum.reserve(providesCnt);
+    al->providesIndex->entryIx.reserve(providesCnt);
+    al->providesIndex->flags.reserve(providesCnt);
+    al->providesIndex->evr.reserve(providesCnt);
 
     int i = 0;
     for (auto const & alp : al->list) {
 	rpmalAddProvides(al, i++, alp.provides);
     }
+    rpmalSortProvides(al);
 }
 
 static void rpmalMakeObsoletesIndex(rpmal al)
@@ -266,6 +336,16 @@ static void rpmalMakeObsoletesIndex(rpmal al)
     }
 }
 
+void rpmalMakeIndex(rpmal al)
+{
+    if (al == NULL)
+	return;
+    if (al->providesIndex == NULL)
+	rpmalMakeProvidesIndex(al);
+    else
+	rpmalSortProvides(al);
+}
+
 std::vector<rpmte> rpmalAllObsoletes(rpmal al, rpmds ds)
 {
     std::vector<rpmte> ret;
@@ -353,6 +433,9 @@ std::vector<rpmte> rpmalAllSatisfiesDepend(const rpmal al, const rpmds ds)
     int obsolete;
     rpmTagVal dtag;
     rpmds filterds = NULL;
+    rpmsenseFlags dsflags;
+    const char *dsevr;
+    rpmver dsver = NULL;
 
     int rc;
 
@@ -374,18 +457,29 @@ std::vector<rpmte> rpmalAllSatisfiesDepend(const rpmal al, const rpmds ds)
 	/* ... then, look for files "provided" by package. */
     }
 
-    if (al->providesHash == NULL)
+    if (al->providesIndex == NULL)
 	rpmalMakeProvidesIndex(al);
-
-    auto range = al->providesHash->equal_range(nameId);
-    for (auto it = range.first; it != range.second; ++it) {
-	auto & alp = al->list[it->second.pkgNum];
+    else
+	rpmalSortProvides(al);
+
+    /* Parse the dependency version once for all the candidates */
+    dsflags = rpmdsFlags(ds);
+    dsevr = rpmdsEVR(ds);
+    if (!obsolete && (dsflags & RPMSENSE_SENSEMASK) && dsevr && *dsevr)
+	dsver = rpmverParse(dsevr);
+
+    rpmalProvidesIndex *pi = al->providesIndex;
+    auto range = std::equal_range(pi->name.begin(), pi->name.end(), nameId);
+    size_t lo = range.first - pi->name.begin();
+    size_t hi = range.second - pi->name.begin();
+    for (size_t i = lo; i < hi; i++) {
+	auto & alp = al->list[pi->pkgNum[i]];
 	if (alp.p == NULL) /* deleted */
 	    continue;
 	/* ignore self-conflicts/obsoletes */
 	if (filterds && rpmteDS(alp.p, rpmdsTagN(filterds)) == filterds)
 	    continue;
-	int ix = it->second.entryIx;
+	int ix = pi->entryIx[i];
 
 	if (obsolete) {
 	    /* Obsoletes are on package NEVR only */
@@ -394,13 +488,17 @@ std::vector<rpmte> rpmalAllSatisfiesDepend(const rpmal al, const rpmds ds)
 		continue;
 	    thisds = rpmteDS(alp.p, RPMTAG_NAME);
 	    rc = rpmdsCompareIndex(thisds, rpmdsIx(thisds), ds, rpmdsIx(ds));
+	} else if (pi->evr[i] && dsver) {
+	    rc = rpmverOverlap(pi->evr[i], pi->flags[i], dsver, dsflags);
 	} else {
-	    rc = rpmdsCompareIndex(alp.provides, ix, ds, rpmdsIx(ds));
+	    /* An existence test on either side always overlaps */
+	    rc = 1;
 	}
 
 	if (rc)
 	    ret.push_back(alp.p);
     }
+    rpmverFree(dsver);
 
     if (!ret.empty()) {
 	rpmdsNotify(ds, "(added provide)", 0);
@@ -45,6 +45,14 @@ void rpmalDel(rpmal al, rpmte p);
 RPM_GNUC_INTERNAL
 void rpmalAdd(rpmal al, rpmte p);
 
+/**
+ * Create the provides index now instead of on first lookup, so that
+ * non-file provides lookups no longer modify the available list.
+ * @param al		available list
+ */
+RPM_GNUC_INTERNAL
+void rpmalMakeIndex(rpmal al);
+
 /**
  * Lookup all obsoleters for a dependency in the available list
  * @param al		available list
@@ -4,6 +4,7 @@
 
 #include "system.h"
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -30,6 +31,7 @@
 #include <rpm/rpmlog.h>
 #include <rpm/rpmdb.h>
 #include <rpm/rpmts.h>
+#include <rpm/rpmkeyring.h>
 #include <rpm/argv.h>
 
 #include "rpmchroot.hh"
@@ -44,6 +46,138 @@
 using std::unordered_map;
 using std::vector;
 
+/* Tags always stored in package summaries */
+static const rpmTagVal summaryTags[] = {
+    RPMTAG_HEADERI18NTABLE,
+    RPMTAG_NAME,
+    RPMTAG_EPOCH,
+    RPMTAG_VERSION,
+    RPMTAG_RELEASE,
+    RPMTAG_ARCH,
+    RPMTAG_SIZE,
+    RPMTAG_LONGSIZE,
+    RPMTAG_INSTALLTIME,
+    RPMTAG_SOURCERPM,
+    RPMTAG_SOURCEPACKAGE,
+    0
+};
+
+/* Tag extensions that can be formatted from the summary tags */
+static const rpmTagVal summaryExts[] = {
+    RPMTAG_NEVRA,
+    RPMTAG_NEVR,
+    RPMTAG_NVRA,
+    RPMTAG_NVR,
+    RPMTAG_EVR,
+    RPMTAG_EPOCHNUM,
+    RPMTAG_DBINSTANCE,
+    0
+};
+
+/* Provides, so that dependency checks can match them from summaries */
+static const rpmTagVal summaryDepTags[] = {
+    RPMTAG_PROVIDENAME,
+    RPMTAG_PROVIDEVERSION,
+    RPMTAG_PROVIDEFLAGS,
+    0
+};
+
+static void summaryConfig(rpmdb db)
+{
+    char *str = rpmExpand("%{?_db_summary_tags}", NULL);
+    ARGV_t tags = NULL;
+
+    /* Stored with the configured tags, so older summaries get regenerated */
+    for (const rpmTagVal *t = summaryDepTags; *t; t++)
+	db->db_sumtags.push_back(*t);
+
+    argvSplit(&tags, str, " \t\n,");
+    for (ARGV_const_t t = tags; t && *t; t++) {
+	rpmTagVal tag = rpmTagGetValue(*t);
+	if (tag == RPMTAG_NOT_FOUND || rpmHeaderTagFunc(tag) != NULL) {
+	    rpmlog(RPMLOG_WARNING, _("invalid tag in %%_db_summary_tags: %s\n"),
+		   *t);
+	    continue;
+	}
+	db->db_sumtags.push_back(tag);
+    }
+    std::sort(db->db_sumtags.begin(), db->db_sumtags.end());
+    db->db_sumtags.erase(std::unique(db->db_sumtags.begin(),
+				     db->db_sumtags.end()),
+			 db->db_sumtags.end());
+    argvFree(tags);
+    free(str);
+}
+
+static int summaryCovers(rpmdb db, rpmTagVal tag)
+{
+    for (const rpmTagVal *t = summaryTags; *t; t++) {
+	if (*t == tag)
+	    return 1;
+    }
+    for (const rpmTagVal *t = summaryExts; *t; t++) {
+	if (*t == tag)
+	    return 1;
+    }
+    return std::binary_search(db->db_sumtags.begin(), db->db_sumtags.end(),
+			      tag);
+}
+
+/* Export a header blob with just the summary tags of h */
+static uint8_t *summaryExport(rpmdb db, Header h, unsigned int *len)
+{
+    Header sh = headerNew();
+    vector<rpmTagVal> tags(db->db_sumtags);
+    uint8_t *blob;
+
+    tags.push_back(0);
+    headerCopyTags(h, sh, summaryTags);
+    headerCopyTags(h, sh, tags.data());
+    blob = (uint8_t *)headerExport(sh, len);
+    headerFree(sh);
+
+    return blob;
+}
+
+static rpmRC summaryPut(rpmdb db, dbiIndex dbi, dbiCursor dbc,
+			unsigned int hdrNum, Header h)
+{
+    unsigned int len = 0;
+    uint8_t *blob = summaryExport(db, h, &len);
+    rpmRC rc = RPMRC_FAIL;
+
+    if (blob && len)
+	rc = sumdbPut(dbi, dbc, hdrNum, blob, len);
+    free(blob);
+
+    return rc;
+}
+
+static int buildSummaries(rpmdb db, dbiIndex dbi)
+{
+    int rc = 0;
+    Header h;
+    rpmdbMatchIterator mi;
+    dbiCursor dbc;
+
+    rpmlog(RPMLOG_DEBUG, "generating package summaries\n");
+
+    dbCtrl(db, DB_CTRL_LOCK_RW);
+    dbc = dbiCursorInit(dbi, DBC_WRITE);
+
+    mi = rpmdbInitIterator(db, RPMDBI_PACKAGES, NULL, 0);
+    while ((h = rpmdbNextIterator(mi))) {
+	if (summaryPut(db, dbi, dbc, headerGetInstance(h), h))
+	    rc++;
+    }
+    rpmdbFreeIterator(mi);
+
+    dbiCursorFree(dbi, dbc);
+    dbCtrl(db, DB_CTRL_UNLOCK_RW);
+
+    return rc;
+}
+
 static int buildIndexes(rpmdb db)
 {
     int rc = 0;
@@ -135,6 +269,11 @@ static int pkgdbOpen(rpmdb db, int flags, dbiIndex *dbip)
 	    db->cfg.db_no_fsync = 1;
 	    dbSetFSync(db, 0);
 	}
+	/* Summaries got enabled on an existing db, fill them in */
+	if (!verifyonly && (dbiFlags(dbi) & DBI_SUMMARY_CREATED) &&
+		!(dbiFlags(dbi) & DBI_CREATED)) {
+	    buildSummaries(db, dbi);
+	}
     } else {
 	rpmlog(RPMLOG_ERR, _("cannot open %s index using %s - %s (%d)\n"),
 		   rpmTagGetName(RPMDBI_PACKAGES), db->db_descr,
@@ -266,6 +405,10 @@ struct rpmdbMatchIterator_s {
     miRE		mi_re;
     rpmts		mi_ts;
     rpmRC (*mi_hdrchk) (rpmts ts, const void * uh, size_t uc, char ** msg);
+    int			mi_snapshot;	/* iterator holds a db snapshot */
+    int			mi_summary;	/* iterator returns summaries */
+    dbiCursor		mi_sumdbc;	/* summary cursor */
+    std::string		mi_keyring;	/* keyring digest (if computed) */
 
 };
 
@@ -278,6 +421,8 @@ struct rpmdbIndexIterator_s {
     dbiIndexSet		ii_set;
     vector<unsigned>	ii_hdrNums;
     int			ii_skipdata;
+    std::string		ii_pfx;
+    int			ii_haspfx;
 };
 
 rpmop rpmdbOp(rpmdb rpmdb, rpmdbOpX opx)
@@ -308,6 +453,115 @@ const char *rpmdbHome(rpmdb db)
     return dbdir;
 }
 
+#define HDRCACHE_MAGIC "rpm-hdrcache 2\n"
+
+static char *hdrCachePath(rpmdb db)
+{
+    return rstrscat(NULL, rpmdbHome(db), "/.hdrcache", NULL);
+}
+
+static void hdrCacheLoad(rpmdb db)
+{
+    char *fn = hdrCachePath(db);
+    FILE *f = fopen(fn, "r");
+    char *line = NULL;
+    size_t len = 0;
+
+    db->db_hdrcache = 1;
+    if (f == NULL)
+	goto exit;
+
+    if (getline(&line, &len, f) < 0 || !rstreq(line, HDRCACHE_MAGIC)) {
+	rpmlog(RPMLOG_DEBUG, "ignoring invalid header check cache %s\n", fn);
+	goto exit;
+    }
+
+    while (getline(&line, &len, f) > 0) {
+	unsigned int hdrNum, vsflags;
+	char digest[129], keyring[129];
+
+	if (sscanf(line, "%u %x %128s %128s",
+		   &hdrNum, &vsflags, digest, keyring) != 4)
+	    continue;
+	db->db_verified[hdrNum] = { digest, vsflags, keyring };
+    }
+    rpmlog(RPMLOG_DEBUG, "loaded %zu entries from header check cache %s\n",
+	   db->db_verified.size(), fn);
+
+exit:
+    if (f)
+	fclose(f);
+    free(line);
+    free(fn);
+}
+
+static void hdrCacheSave(rpmdb db)
+{
+    char *fn = hdrCachePath(db);
+    char *tmpfn = rstrscat(NULL, fn, ".XXXXXX", NULL);
+    int fd = mkstemp(tmpfn);
+    FILE *f = NULL;
+
+    /* Not being able to save is fine, eg for non-root queries */
+    if (fd < 0)
+	goto exit;
+
+    /* Readable to everybody like the database itself */
+    if (fchmod(fd, 0644) || (f = fdopen(fd, "w")) == NULL) {
+	close(fd);
+	unlink(tmpfn);
+	goto exit;
+    }
+
+    fputs(HDRCACHE_MAGIC, f);
+    for (auto const & [hdrNum, entry] : db->db_verified) {
+	fprintf(f, "%u %x %s %s\n", hdrNum, entry.vsflags,
+		entry.digest.c_str(), entry.keyring.c_str());
+    }
+
+    if (fclose(f) || rename(tmpfn, fn))
+	unlink(tmpfn);
+
+exit:
+    free(tmpfn);
+    free(fn);
+}
+
+static char *hdrCacheDigest(const void *uh, size_t uhlen)
+{
+    DIGEST_CTX ctx = rpmDigestInit(RPM_HASH_SHA256, RPMDIGEST_NONE);
+    char *digest = NULL;
+
+    rpmDigestUpdate(ctx, uh, uhlen);
+    rpmDigestFinal(ctx, (void **)&digest, NULL, 1);
+    return digest;
+}
+
+/* Digest of all keys in the transaction keyring */
+static std::string hdrCacheKeyring(rpmts ts)
+{
+    rpmKeyring keyring = rpmtsGetKeyring(ts, 1);
+    rpmKeyringIterator iter = rpmKeyringInitIterator(keyring, 0);
+    DIGEST_CTX ctx = rpmDigestInit(RPM_HASH_SHA256, RPMDIGEST_NONE);
+    rpmPubkey key;
+    char *digest = NULL;
+
+    /* Keys iterate in key id order, always the same for the same keys */
+    while ((key = rpmKeyringIteratorNext(iter)) != NULL) {
+	char *b64 = rpmPubkeyBase64(key);
+	if (b64)
+	    rpmDigestUpdate(ctx, b64, strlen(b64) + 1);
+	free(b64);
+    }
+    rpmDigestFinal(ctx, (void **)&digest, NULL, 1);
+    rpmKeyringIteratorFree(iter);
+    rpmKeyringFree(keyring);
+
+    std::string ret(digest);
+    free(digest);
+    return ret;
+}
+
 static int doOpen(rpmdb db, int justPkgs)
 {
     int rc = pkgdbOpen(db, db->db_flags, NULL);
@@ -352,6 +606,9 @@ int rpmdbClose(rpmdb db)
     if ((db->db_mode & O_ACCMODE) != O_RDONLY)
 	dbSetFSync(db, 1);
 
+    if (db->db_hdrcache > 1)
+	hdrCacheSave(db);
+
     if (db->db_pkgs)
 	rc = dbiClose(db->db_pkgs, 0);
     rc += dbiForeach(db->db_indexes, db->db_ndbi, dbiClose, 1);
@@ -407,6 +664,11 @@ static rpmdb newRpmdb(const char * root, const char * home,
     db->db_mode = (mode >= 0) ? mode : 0;
     db->db_perms = (perms >= 0) ? perms : 0644;
     db->db_flags = (flags >= 0) ? flags : 0;
+    db->db_snapshot = ((db->db_mode & O_ACCMODE) == O_RDONLY) &&
+		      rpmExpandNumeric("%{?_db_snapshot}");
+    db->db_summary = rpmExpandNumeric("%{?_db_summary}");
+    if (db->db_summary)
+	summaryConfig(db);
 
     db->db_home = db_home;
     db->db_root = rpmGetPath((root && *root) ? root : "/", NULL);
@@ -445,6 +707,11 @@ static int openDatabase(const char * prefix,
 
 	if (!db->db_descr)
 	    db->db_descr = "unknown db";
+
+	if (rc == 0 && !justCheck &&
+		!(db->db_flags & (RPMDB_FLAG_REBUILD|RPMDB_FLAG_VERIFYONLY)) &&
+		rpmExpandNumeric("%{?_hdrcheck_cache}") > 0)
+	    hdrCacheLoad(db);
     }
 
     if (rc || justCheck || dbp == NULL)
@@ -880,7 +1147,8 @@ static int miFreeHeader(rpmdbMatchIterator mi, dbiIndex dbi)
     if (mi == NULL || mi->mi_h == NULL)
 	return 0;
 
-    if (dbi && mi->mi_dbc && mi->mi_modified && mi->mi_prevoffset) {
+    if (dbi && mi->mi_dbc && mi->mi_modified && mi->mi_prevoffset &&
+	    !mi->mi_summary) {
 	rpmRC rpmrc = RPMRC_NOTFOUND;
 	unsigned int hdrLen = 0;
 	uint8_t *hdrBlob = (uint8_t *)headerExport(mi->mi_h, &hdrLen);
@@ -903,6 +1171,11 @@ static int miFreeHeader(rpmdbMatchIterator mi, dbiIndex dbi)
 	    dbCtrl(mi->mi_db, DB_CTRL_LOCK_RW);
 	    rc = pkgdbPut(dbi, mi->mi_dbc, &mi->mi_prevoffset,
 			  hdrBlob, hdrLen);
+	    if (rc == 0 && (dbiFlags(dbi) & DBI_SUMMARY)) {
+		dbiCursor dbc = dbiCursorInit(dbi, DBC_WRITE);
+		summaryPut(mi->mi_db, dbi, dbc, mi->mi_prevoffset, mi->mi_h);
+		dbiCursorFree(dbi, dbc);
+	    }
 	    dbCtrl(mi->mi_db, DB_CTRL_INDEXSYNC);
 	    dbCtrl(mi->mi_db, DB_CTRL_UNLOCK_RW);
 	    rpmsqBlock(SIG_UNBLOCK);
@@ -921,6 +1194,26 @@ static int miFreeHeader(rpmdbMatchIterator mi, dbiIndex dbi)
     return rc;
 }
 
+/*
+ * Iterators on read-only handles share a single backend snapshot,
+ * which is taken by the first one and dropped with the last one.
+ */
+static int snapshotBegin(rpmdb db)
+{
+    if (!db->db_snapshot || pkgdbOpen(db, 0, NULL))
+	return 0;
+    if (db->db_snapshots == 0 && dbCtrl(db, DB_CTRL_SNAPSHOT_BEGIN))
+	return 0;
+    db->db_snapshots++;
+    return 1;
+}
+
+static void snapshotEnd(rpmdb db)
+{
+    if (--db->db_snapshots == 0)
+	dbCtrl(db, DB_CTRL_SNAPSHOT_END);
+}
+
 rpmdbMatchIterator rpmdbFreeIterator(rpmdbMatchIterator mi)
 {
     dbiIndex dbi = NULL;
@@ -934,6 +1227,7 @@ rpmdbMatchIterator rpmdbFreeIterator(rpmdbMatchIterator mi)
     miFreeHeader(mi, dbi);
 
     mi->mi_dbc = dbiCursorFree(dbi, mi->mi_dbc);
+    mi->mi_sumdbc = dbiCursorFree(dbi, mi->mi_sumdbc);
 
     if (mi->mi_re != NULL)
     for (i = 0; i < mi->mi_nre; i++) {
@@ -947,6 +1241,8 @@ rpmdbMatchIterator rpmdbFreeIterator(rpmdbMatchIterator mi)
     mi->mi_re = _free(mi->mi_re);
 
     mi->mi_set = dbiIndexSetFree(mi->mi_set);
+    if (mi->mi_snapshot)
+	snapshotEnd(mi->mi_db);
     rpmdbClose(mi->mi_db);
     mi->mi_ts = rpmtsFree(mi->mi_ts);
 
@@ -1304,6 +1600,30 @@ int rpmdbSetIteratorModified(rpmdbMatchIterator mi, int modified)
     return rc;
 }
 
+int rpmdbSetIteratorSummary(rpmdbMatchIterator mi,
+			    const rpmTagVal *tags, int ntags)
+{
+    dbiIndex dbi = NULL;
+
+    if (mi == NULL || mi->mi_dbc != NULL || (mi->mi_cflags & DBC_WRITE))
+	return 0;
+
+    if (pkgdbOpen(mi->mi_db, 0, &dbi) || !(dbiFlags(dbi) & DBI_SUMMARY))
+	return 0;
+
+    for (int i = 0; i < ntags; i++) {
+	if (!summaryCovers(mi->mi_db, tags[i]))
+	    return 0;
+    }
+    for (int i = 0; i < mi->mi_nre; i++) {
+	if (!summaryCovers(mi->mi_db, mi->mi_re[i].tag))
+	    return 0;
+    }
+
+    mi->mi_summary = 1;
+    return 1;
+}
+
 int rpmdbSetHdrChk(rpmdbMatchIterator mi, rpmts ts,
 	rpmRC (*hdrchk) (rpmts ts, const void *uh, size_t uc, char ** msg))
 {
@@ -1333,10 +1653,42 @@ static rpmRC miVerifyHeader(rpmdbMatchIterator mi, const void *uh, size_t uhlen)
 
     /* If blob is unchecked, check blob import consistency now. */
     if (rpmrc != RPMRC_OK) {
+	rpmdb db = mi->mi_db;
+	unsigned int vsflags = rpmtsVSFlags(mi->mi_ts);
+	char * digest = NULL;
 	char * msg = NULL;
 	int lvl;
 
-	rpmrc = (*mi->mi_hdrchk) (mi->mi_ts, uh, uhlen, &msg);
+	/*
+	 * A result from an earlier run is good for the same blob if it
+	 * didn't skip any checks that are enabled now, and the keys
+	 * are the same. Keys can change in any keystore without us
+	 * seeing it, so compare the whole keyring.
+	 */
+	if (db->db_hdrcache && !verifyonly) {
+	    digest = hdrCacheDigest(uh, uhlen);
+	    if (mi->mi_keyring.empty())
+		mi->mi_keyring = hdrCacheKeyring(mi->mi_ts);
+	    auto entry = db->db_verified.find(mi->mi_offset);
+	    if (entry != db->db_verified.end() &&
+		    entry->second.digest == digest &&
+		    entry->second.keyring == mi->mi_keyring &&
+		    (entry->second.vsflags & ~vsflags) == 0) {
+		rpmrc = RPMRC_OK;
+		msg = xstrdup("(cached)");
+	    }
+	}
+
+	if (rpmrc != RPMRC_OK) {
+	    rpmrc = (*mi->mi_hdrchk) (mi->mi_ts, uh, uhlen, &msg);
+	    if (rpmrc == RPMRC_OK && digest) {
+		db->db_verified[mi->mi_offset] = { digest, vsflags,
+						   mi->mi_keyring };
+		db->db_hdrcache = 2;
+	    }
+	}
+	free(digest);
+
 	lvl = (rpmrc == RPMRC_FAIL ? RPMLOG_ERR : RPMLOG_DEBUG);
 	rpmlog(lvl, "%s h#%8u %s\n",
 	    (rpmrc == RPMRC_FAIL ? _("rpmdbNextIterator: skipping") : " read"),
@@ -1356,7 +1708,9 @@ Header rpmdbNextIterator(rpmdbMatchIterator mi)
 {
     dbiIndex dbi = NULL;
     unsigned char * uh;
+    unsigned char * blob;
     unsigned int uhlen;
+    int summary;
     int rc;
     headerImportFlags importFlags = HEADERIMPORT_FAST;
 
@@ -1376,10 +1730,13 @@ Header rpmdbNextIterator(rpmdbMatchIterator mi)
      */
     if (mi->mi_dbc == NULL)
 	mi->mi_dbc = dbiCursorInit(dbi, mi->mi_cflags);
+    if (mi->mi_summary && mi->mi_sumdbc == NULL)
+	mi->mi_sumdbc = dbiCursorInit(dbi, DBC_READ);
 
 top:
     uh = NULL;
     uhlen = 0;
+    summary = 0;
 
     do {
 	if (mi->mi_set) {
@@ -1387,6 +1744,12 @@ top:
 		return NULL;
 	    mi->mi_offset = dbiIndexRecordOffset(mi->mi_set, mi->mi_setx);
 	    mi->mi_filenum = dbiIndexRecordFileNumber(mi->mi_set, mi->mi_setx);
+	} else if (mi->mi_summary) {
+	    rc = sumdbGet(dbi, mi->mi_sumdbc, 0, &uh, &uhlen);
+	    if (rc == 0) {
+		mi->mi_offset = pkgdbKey(dbi, mi->mi_sumdbc);
+		summary = (uh != NULL);
+	    }
 	} else {
 	    rc = pkgdbGet(dbi, mi->mi_dbc, 0, &uh, &uhlen);
 	    if (rc == 0)
@@ -1403,9 +1766,20 @@ top:
     if (mi->mi_prevoffset && mi->mi_offset == mi->mi_prevoffset)
 	return mi->mi_h;
 
+    /* Use the summary if available, the full header otherwise */
+    if (uh == NULL && mi->mi_summary && mi->mi_set) {
+	summary = (sumdbGet(dbi, mi->mi_sumdbc, mi->mi_offset,
+			    &uh, &uhlen) == RPMRC_OK);
+	if (!summary)
+	    uh = NULL;
+    }
+
     /* Retrieve next header blob for index iterator. */
     if (uh == NULL) {
 	rc = pkgdbGet(dbi, mi->mi_dbc, mi->mi_offset, &uh, &uhlen);
+	/* Not part of the snapshot, skip */
+	if (rc == RPMRC_NOTFOUND && mi->mi_snapshot)
+	    goto top;
 	if (rc)
 	    return NULL;
     }
@@ -1418,12 +1792,21 @@ top:
 	return NULL;
 
     /* Verify header if enabled, skip damaged and inconsistent headers */
-    if (miVerifyHeader(mi, uh, uhlen) == RPMRC_FAIL) {
+    if (!summary && miVerifyHeader(mi, uh, uhlen) == RPMRC_FAIL) {
 	goto top;
     }
 
     /* Did the header blob load correctly? */
-    mi->mi_h = headerImport(uh, uhlen, importFlags);
+    if (summary) {
+	mi->mi_h = headerImport(uh, uhlen, importFlags);
+    } else if ((blob = pkgdbTake(dbi, mi->mi_dbc, uh)) != NULL) {
+	/* The header takes over the blob, no need to copy */
+	mi->mi_h = headerImport(blob, uhlen, importFlags & ~HEADERIMPORT_COPY);
+	if (mi->mi_h == NULL)
+	    free(blob);
+    } else {
+	mi->mi_h = headerImport(uh, uhlen, importFlags);
+    }
     if (mi->mi_h == NULL || !headerIsEntry(mi->mi_h, RPMTAG_NAME)) {
 	rpmlog(RPMLOG_ERR,
 		_("rpmdb: damaged header #%u retrieved -- skipping.\n"),
@@ -1445,6 +1828,59 @@ top:
     return mi->mi_h;
 }
 
+int rpmdbForeachIterator(rpmdbMatchIterator mi, int nthreads,
+			 rpmdbForeachFunc func, rpmdbEmitFunc emit,
+			 void *data)
+{
+    vector<Header> hdrs;
+    vector<void *> results;
+    vector<int> rcs;
+    size_t batchsize;
+    int ec = 0;
+
+    if (mi == NULL || func == NULL)
+	return 1;
+
+#ifndef ENABLE_OPENMP
+    nthreads = 1;
+#endif
+    if (nthreads < 1)
+	nthreads = 1;
+    batchsize = nthreads * 16;
+
+    for (;;) {
+	Header h;
+
+	/* The database backends are single threaded, read in this thread */
+	hdrs.clear();
+	while (hdrs.size() < batchsize && (h = rpmdbNextIterator(mi)))
+	    hdrs.push_back(headerLink(h));
+	if (hdrs.empty())
+	    break;
+
+	size_t n = hdrs.size();
+	results.assign(n, NULL);
+	rcs.assign(n, 0);
+
+	#pragma omp parallel for schedule(dynamic) num_threads(nthreads) if (n > 1)
+	for (size_t i = 0; i < n; i++)
+	    rcs[i] = func(hdrs[i], data, &results[i]);
+
+	for (size_t i = 0; i < n; i++) {
+	    if (rcs[i])
+		ec = rcs[i];
+	    if (emit) {
+		int rc = emit(hdrs[i], results[i], data);
+		if (rc)
+		    ec = rc;
+	    }
+	    headerFree(hdrs[i]);
+	}
+    }
+
+    return ec;
+}
+
 /** \ingroup rpmdb
  * sort the iterator by (recnum, filenum)
  * Return database iterator.
@@ -1657,10 +2093,17 @@ rpmdbMatchIterator rpmdbInitIterator(rpmdb db, rpmDbiTagVal rpmtag,
     rpmdbMatchIterator mi = NULL;
 
     if (db != NULL) {
+	int snapshot = snapshotBegin(db);
+
 	if (rpmtag == RPMDBI_PACKAGES)
 	    mi = pkgdbIterInit(db, (unsigned int *)keyp, keylen);
 	else
 	    mi = indexIterInit(db, rpmtag, (const char *)keyp, keylen);
+
+	if (mi)
+	    mi->mi_snapshot = snapshot;
+	else if (snapshot)
+	    snapshotEnd(db);
     }
 
     return mi;
@@ -1678,6 +2121,7 @@ rpmdbMatchIterator rpmdbInitPrefixIterator(rpmdb db, rpmDbiTagVal rpmtag,
 	return NULL;
 
     if (db != NULL && rpmtag != RPMDBI_PACKAGES) {
+	int snapshot = snapshotBegin(db);
 
 	if (indexOpen(db, dbtag, 0, &dbi) == 0) {
 	    int rc = 0;
@@ -1689,10 +2133,13 @@ rpmdbMatchIterator rpmdbInitPrefixIterator(rpmdb db, rpmDbiTagVal rpmtag,
 	    } else {
 		mi = rpmdbNewIterator(db, dbtag);
 		mi->mi_set = set;
+		mi->mi_snapshot = snapshot;
 		rpmdbSortIterator(mi);
 	    }
 	}
 
+	if (mi == NULL && snapshot)
+	    snapshotEnd(db);
     }
 
     return mi;
@@ -1777,7 +2224,19 @@ rpmdbIndexIterator rpmdbIndexIteratorInit(rpmdb db, rpmDbiTag rpmtag)
 rpmdbIndexIterator rpmdbIndexKeyIteratorInit(rpmdb db, rpmDbiTag rpmtag)
 {
     rpmdbIndexIterator ki = rpmdbIndexIteratorInit(db, rpmtag);
-    ki->ii_skipdata = 1;
+    if (ki)
+	ki->ii_skipdata = 1;
+    return ki;
+}
+
+rpmdbIndexIterator rpmdbIndexKeyIteratorInitPrefix(rpmdb db, rpmDbiTag rpmtag,
+					const char *pfx, size_t plen)
+{
+    rpmdbIndexIterator ki = rpmdbIndexKeyIteratorInit(db, rpmtag);
+    if (ki) {
+	ki->ii_pfx.assign(pfx, plen ? plen : strlen(pfx));
+	ki->ii_haspfx = 1;
+    }
     return ki;
 }
 
@@ -1795,8 +2254,14 @@ int rpmdbIndexIteratorNext(rpmdbIndexIterator ii, const void ** key, size_t * ke
     /* free old data */
     ii->ii_set = dbiIndexSetFree(ii->ii_set);
 
-    rc = idxdbGet(ii->ii_dbi, ii->ii_dbc, NULL, 0,
-		ii->ii_skipdata ? NULL : &ii->ii_set, DBC_NORMAL_SEARCH);
+    if (ii->ii_haspfx) {
+	rc = idxdbGet(ii->ii_dbi, ii->ii_dbc,
+		    ii->ii_pfx.data(), ii->ii_pfx.size(),
+		    ii->ii_skipdata ? NULL : &ii->ii_set, DBC_PREFIX_ITER);
+    } else {
+	rc = idxdbGet(ii->ii_dbi, ii->ii_dbc, NULL, 0,
+		    ii->ii_skipdata ? NULL : &ii->ii_set, DBC_NORMAL_SEARCH);
+    }
 
     *key = idxdbKey(ii->ii_dbi, ii->ii_dbc, &iikeylen);
     *keylen = iikeylen;
@@ -1964,6 +2429,11 @@ int rpmdbRemove(rpmdb db, unsigned int hdrNum)
     dbCtrl(db, DB_CTRL_UNLOCK_RW);
     rpmsqBlock(SIG_UNBLOCK);
 
+    if (db->db_hdrcache) {
+	db->db_verified.erase(hdrNum);
+	db->db_hdrcache = 2;
+    }
+
     headerFree(h);
 
     /* XXX return ret; */
@@ -2053,13 +2523,18 @@ static int updateRichDep(dbiIndex dbi, dbiCursor dbc, const char *str,
     return rc;
 }
 
-rpmRC tag2index(dbiIndex dbi, rpmTagVal rpmtag,
-		       unsigned int hdrNum, Header h,
-		       idxfunc idxupdate)
+/*
+ * Generate the index keys of a header for rpmtag and pass them on to
+ * idxupdate. A write cursor is opened for the duration unless the caller
+ * supplies its own in bulkc.
+ */
+rpmRC tag2keys(dbiIndex dbi, dbiCursor bulkc, rpmTagVal rpmtag,
+	       unsigned int hdrNum, Header h,
+	       idxfunc idxupdate)
 {
     int i, rc = 0;
     struct rpmtd_s tagdata, reqflags, trig_index;
-    dbiCursor dbc = NULL;
+    dbiCursor dbc = bulkc;
 
     switch (rpmtag) {
     case RPMTAG_REQUIRENAME:
@@ -2084,7 +2559,8 @@ rpmRC tag2index(dbiIndex dbi, rpmTagVal rpmtag,
 	tagdata.count = 1;
     }
 
-    dbc = dbiCursorInit(dbi, DBC_WRITE);
+    if (dbc == NULL)
+	dbc = dbiCursorInit(dbi, DBC_WRITE);
 
     logAddRemove(dbiName(dbi), 0, &tagdata);
     while ((i = rpmtdNext(&tagdata)) >= 0) {
@@ -2155,13 +2631,21 @@ rpmRC tag2index(dbiIndex dbi, rpmTagVal rpmtag,
 	}
     }
 
-    dbiCursorFree(dbi, dbc);
+    if (dbc != bulkc)
+	dbiCursorFree(dbi, dbc);
 
 exit:
     rpmtdFreeData(&tagdata);
     return (rc == 0) ? RPMRC_OK : RPMRC_FAIL;
 }
 
+rpmRC tag2index(dbiIndex dbi, rpmTagVal rpmtag,
+		       unsigned int hdrNum, Header h,
+		       idxfunc idxupdate)
+{
+    return tag2keys(dbi, NULL, rpmtag, hdrNum, h, idxupdate);
+}
+
 static bool validHeader(Header h)
 {
     if (!(headerIsEntry(h, RPMTAG_NAME) &&
@@ -2204,6 +2688,13 @@ int rpmdbAdd(rpmdb db, Header h)
     ret = pkgdbPut(dbi, dbc, &hdrNum, hdrBlob, hdrLen);
     dbiCursorFree(dbi, dbc);
 
+    /* A missing summary only costs speed, don't fail on it */
+    if (ret == 0 && (dbiFlags(dbi) & DBI_SUMMARY)) {
+	dbc = dbiCursorInit(dbi, DBC_WRITE);
+	summaryPut(db, dbi, dbc, hdrNum, h);
+	dbiCursorFree(dbi, dbc);
+    }
+
     /* Add associated data to secondary indexes */
     if (ret == 0) {	
 	for (int dbix = 0; dbix < db->db_ndbi; dbix++) {
@@ -2358,6 +2849,269 @@ static int rpmdbSetPermissions(char * src, char * dest)
     return rc;
 }
 
+namespace {
+/* An index key collected from a header during bulk rebuild */
+struct bulkKey {
+    std::string key;
+    struct dbiIndexItem_s rec;
+
+    bool operator < (const bulkKey & other) const {
+	int cmp = key.compare(other.key);
+	return (cmp != 0) ? (cmp < 0) : (rec < other.rec);
+    }
+};
+
+/* Pseudo-cursor for tag2keys(), collects keys instead of writing them */
+struct bulkCursor : public dbiCursor_s {
+    vector<bulkKey> keys;
+};
+
+static rpmRC bulkCollect(dbiIndex dbi, dbiCursor dbc,
+			 const char *keyp, size_t keylen, dbiIndexItem rec)
+{
+    bulkCursor *bc = static_cast<bulkCursor *>(dbc);
+    bc->keys.push_back({std::string(keyp, keylen), *rec});
+    return RPMRC_OK;
+}
+
+struct rebuildJob {
+    unsigned int offset;	/* header instance in the old db */
+    unsigned char *uh;		/* header blob from the old db */
+    unsigned int uhlen;
+    uint8_t *hdrBlob;		/* header blob for the new db (or NULL) */
+    unsigned int hdrLen;
+    uint8_t *sumBlob;		/* summary blob for the new db (or NULL) */
+    unsigned int sumLen;
+    vector<bulkCursor> idx;	/* collected keys per new db index */
+};
+}
+
+/* Import a header and collect its index keys, this runs in parallel */
+static void rebuildDecode(rpmdb newdb, struct rebuildJob *job)
+{
+    Header h = headerImport(job->uh, job->uhlen, HEADERIMPORT_FAST);
+
+    /* The blob is owned by the header once imported */
+    if (h != NULL)
+	job->uh = NULL;
+
+    if (h == NULL || !headerIsEntry(h, RPMTAG_NAME)) {
+	rpmlog(RPMLOG_ERR,
+		_("rpmdb: damaged header #%u retrieved -- skipping.\n"),
+		job->offset);
+	goto exit;
+    }
+
+    /* let's sanity check this record a bit, otherwise just skip it */
+    if (!validHeader(h)) {
+	rpmlog(RPMLOG_ERR,
+		_("header #%u in the database is bad -- skipping.\n"),
+		job->offset);
+	goto exit;
+    }
+
+    job->hdrBlob = (uint8_t *)headerExport(h, &job->hdrLen);
+    if (job->hdrBlob == NULL || job->hdrLen == 0)
+	goto exit;
+
+    if (dbiFlags(newdb->db_pkgs) & DBI_SUMMARY)
+	job->sumBlob = summaryExport(newdb, h, &job->sumLen);
+
+    job->idx.resize(newdb->db_ndbi);
+    for (int dbix = 0; dbix < newdb->db_ndbi; dbix++) {
+	dbiIndex dbi = newdb->db_indexes[dbix];
+	if (dbi == NULL)
+	    continue;
+	tag2keys(dbi, &job->idx[dbix], newdb->db_tags[dbix], 0, h,
+		 bulkCollect);
+    }
+
+exit:
+    job->uh = _free(job->uh);
+    headerFree(h);
+}
+
+/* Add a batch of decoded headers to the new db, in the original order */
+static int rebuildAdd(rpmdb newdb, dbiIndex dbi,
+		      vector<struct rebuildJob> & jobs,
+		      vector<vector<bulkKey>> & keys)
+{
+    int rc = 0;
+    dbiCursor dbc = NULL;
+    dbiCursor sdbc = NULL;
+
+    rpmsqBlock(SIG_BLOCK);
+    dbCtrl(newdb, DB_CTRL_LOCK_RW);
+    dbc = dbiCursorInit(dbi, DBC_WRITE);
+    sdbc = dbiCursorInit(dbi, DBC_WRITE);
+
+    for (auto & job : jobs) {
+	unsigned int hdrNum = 0;
+
+	if (job.hdrBlob == NULL)
+	    continue;
+
+	if (pkgdbPut(dbi, dbc, &hdrNum, job.hdrBlob, job.hdrLen)) {
+	    rpmlog(RPMLOG_ERR, _("cannot add record originally at %u\n"),
+		   job.offset);
+	    rc = 1;
+	    break;
+	}
+
+	if (job.sumBlob)
+	    sumdbPut(dbi, sdbc, hdrNum, job.sumBlob, job.sumLen);
+
+	for (size_t dbix = 0; dbix < job.idx.size(); dbix++) {
+	    for (auto & k : job.idx[dbix].keys) {
+		k.rec.hdrNum = hdrNum;
+		keys[dbix].push_back(std::move(k));
+	    }
+	}
+    }
+
+    dbiCursorFree(dbi, sdbc);
+    dbiCursorFree(dbi, dbc);
+    dbCtrl(newdb, DB_CTRL_UNLOCK_RW);
+    rpmsqBlock(SIG_UNBLOCK);
+
+    for (auto & job : jobs) {
+	free(job.uh);
+	free(job.hdrBlob);
+	free(job.sumBlob);
+    }
+    jobs.clear();
+    return rc;
+}
+
+/* Load sorted keys into an index, all records of a key at once */
+static int rebuildLoadIndex(rpmdb newdb, dbiIndex dbi, vector<bulkKey> & keys)
+{
+    int rc = 0;
+    dbiIndexSet set = dbiIndexSetNew(0);
+    dbiCursor dbc = NULL;
+    size_t i = 0;
+
+    rpmsqBlock(SIG_BLOCK);
+    dbCtrl(newdb, DB_CTRL_LOCK_RW);
+    dbc = dbiCursorInit(dbi, DBC_WRITE);
+
+    while (i < keys.size() && rc == 0) {
+	const std::string & key = keys[i].key;
+
+	dbiIndexSetClear(set);
+	for (; i < keys.size() && keys[i].key == key; i++) {
+	    dbiIndexSetAppendOne(set, keys[i].rec.hdrNum,
+				 keys[i].rec.tagNum, 0);
+	}
+	rc = idxdbPutSet(dbi, dbc, key.data(), key.size(), set);
+    }
+
+    dbiCursorFree(dbi, dbc);
+    dbCtrl(newdb, DB_CTRL_UNLOCK_RW);
+    rpmsqBlock(SIG_UNBLOCK);
+
+    dbiIndexSetFree(set);
+    keys.clear();
+    keys.shrink_to_fit();
+    return rc;
+}
+
+/*
+ * Copy all valid headers from olddb to newdb. Headers are imported and
+ * their index keys generated in parallel, the keys of each index are
+ * then sorted and loaded in one go instead of updating every index
+ * one package at a time.
+ */
+static int rebuildPackages(rpmdb olddb, rpmdb newdb, rpmts ts,
+		rpmRC (*hdrchk) (rpmts ts, const void *uh, size_t uc, char ** msg))
+{
+    dbiIndex odbi = NULL;
+    dbiIndex ndbi = NULL;
+    dbiCursor odbc = NULL;
+    vector<struct rebuildJob> jobs;
+    vector<vector<bulkKey>> keys(newdb->db_ndbi);
+    size_t batchsize;
+    int nthreads = 1;
+    int rc = 0;
+
+#ifdef ENABLE_OPENMP
+    nthreads = rpmExpandNumeric("%{?_rebuilddb_nthreads}");
+    if (nthreads < 1)
+	nthreads = 1;
+#endif
+    batchsize = nthreads * 64;
+
+    if (pkgdbOpen(olddb, 0, &odbi) || pkgdbOpen(newdb, 0, &ndbi))
+	return 1;
+
+    odbc = dbiCursorInit(odbi, DBC_READ);
+    while (rc == 0) {
+	unsigned char *uh = NULL;
+	unsigned int uhlen = 0;
+	int done = (pkgdbGet(odbi, odbc, 0, &uh, &uhlen) != RPMRC_OK);
+
+	if (!done && uh) {
+	    struct rebuildJob job = {};
+	    job.offset = pkgdbKey(odbi, odbc);
+	    if (job.offset == 0)
+		continue;
+
+	    /* Verify header if enabled, skip damaged and inconsistent ones */
+	    if (ts && hdrchk) {
+		char *msg = NULL;
+		rpmRC rpmrc = hdrchk(ts, uh, uhlen, &msg);
+		int lvl = (rpmrc == RPMRC_FAIL ? RPMLOG_ERR : RPMLOG_DEBUG);
+		rpmlog(lvl, "%s h#%8u %s\n",
+		    (rpmrc == RPMRC_FAIL ? _("rpmdbNextIterator: skipping") : " read"),
+			    job.offset, (msg ? msg : ""));
+		free(msg);
+		if (rpmrc == RPMRC_FAIL)
+		    continue;
+	    }
+
+	    job.uh = (unsigned char *)memcpy(xmalloc(uhlen), uh, uhlen);
+	    job.uhlen = uhlen;
+	    jobs.push_back(std::move(job));
+	}
+
+	if (jobs.size() >= batchsize || (done && !jobs.empty())) {
+	    int njobs = jobs.size();
+
+	    #pragma omp parallel for schedule(dynamic) num_threads(nthreads) if (njobs > 1)
+	    for (int i = 0; i < njobs; i++)
+		rebuildDecode(newdb, &jobs[i]);
+
+	    rc = rebuildAdd(newdb, ndbi, jobs, keys);
+	}
+
+	if (done)
+	    break;
+    }
+    dbiCursorFree(odbi, odbc);
+
+    if (rc == 0) {
+	int nkeys = keys.size();
+
+	#pragma omp parallel for schedule(dynamic) num_threads(nthreads) if (nthreads > 1)
+	for (int dbix = 0; dbix < nkeys; dbix++)
+	    std::sort(keys[dbix].begin(), keys[dbix].end());
+
+	for (int dbix = 0; rc == 0 && dbix < nkeys; dbix++) {
+	    dbiIndex dbi = newdb->db_indexes[dbix];
+	    if (dbi == NULL || keys[dbix].empty())
+		continue;
+	    rpmlog(RPMLOG_DEBUG, "loading %zu entries to %s index.\n",
+		   keys[dbix].size(), dbiName(dbi));
+	    if (rebuildLoadIndex(newdb, dbi, keys[dbix])) {
+		rpmlog(RPMLOG_ERR, _("cannot build %s index\n"), dbiName(dbi));
+		rc = 1;
+	    }
+	}
+    }
+
+    return rc;
+}
+
 int rpmdbRebuild(const char * prefix, rpmts ts,
 		rpmRC (*hdrchk) (rpmts ts, const void *uh, size_t uc, char ** msg),
 		int rebuildflags)
@@ -2414,35 +3168,8 @@ int rpmdbRebuild(const char * prefix, rpmts ts,
 	goto exit;
     }
 
-    {	Header h = NULL;
-	rpmdbMatchIterator mi;
-
-	mi = rpmdbInitIterator(olddb, RPMDBI_PACKAGES, NULL, 0);
-	if (ts && hdrchk)
-	    (void) rpmdbSetHdrChk(mi, ts, hdrchk);
-
-	while ((h = rpmdbNextIterator(mi)) != NULL) {
-
-	    /* let's sanity check this record a bit, otherwise just skip it */
-	    if (!validHeader(h)) {
-		rpmlog(RPMLOG_ERR,
-			_("header #%u in the database is bad -- skipping.\n"),
-			rpmdbGetIteratorOffset(mi));
-		continue;
-	    }
-
-	    rc = rpmdbAdd(newdb, h);
-	    if (rc) {
-		rpmlog(RPMLOG_ERR, _("cannot add record originally at %u\n"),
-		       rpmdbGetIteratorOffset(mi));
-		failed = 1;
-		break;
-	    }
-	}
-
-	rpmdbFreeIterator(mi);
-
-    }
+    if (rebuildPackages(olddb, newdb, ts, hdrchk))
+	failed = 1;
 
     rpmdbClose(olddb);
     dbCtrl(newdb, DB_CTRL_INDEXSYNC);
@@ -2503,6 +3230,9 @@ int rpmdbCtrl(rpmdb db, rpmdbCtrlOp ctrl)
     case RPMDB_CTRL_INDEXSYNC:
 	dbctrl = DB_CTRL_INDEXSYNC;
 	break;
+    case RPMDB_CTRL_COMPACT:
+	dbctrl = DB_CTRL_COMPACT;
+	break;
     }
     return dbctrl ? dbCtrl(db, dbctrl) : 1;
 }
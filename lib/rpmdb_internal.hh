@@ -170,6 +170,19 @@ rpmdbMatchIterator rpmdbNewIterator(rpmdb db, rpmDbiTagVal dbitag);
 RPM_GNUC_INTERNAL
 rpmdbMatchIterator rpmdbInitPrefixIterator(rpmdb db, rpmDbiTagVal rpmtag,
 					const char* pfx, size_t plen);
+
+/** \ingroup rpmdb
+ * Get a key iterator over the index keys starting with a prefix.
+ * @param db		rpm database
+ * @param rpmtag	database index tag
+ * @param pfx		prefix data
+ * @param plen		prefix data length (0 will use strlen(pfx))
+ * @return		NULL on failure
+ */
+RPM_GNUC_INTERNAL
+rpmdbIndexIterator rpmdbIndexKeyIteratorInitPrefix(rpmdb db, rpmDbiTag rpmtag,
+					const char *pfx, size_t plen);
+
 /** \ingroup rpmdb
  * Get package offsets of entries
  * @param ii		index iterator
@@ -212,4 +225,18 @@ unsigned int rpmdbGetIteratorOffsetFor(rpmdbMatchIterator mi, unsigned int ix);
 RPM_GNUC_INTERNAL
 Header rpmdbGetHeaderAt(rpmdb db, unsigned int offset);
 
+/** \ingroup rpmdb
+ * Make iterator return package summaries instead of full headers, if
+ * the database has them and they cover all the given tags (and the
+ * iterator selectors). Summary headers are not verified. Must be called
+ * before the first rpmdbNextIterator(), not valid for rewriting.
+ * @param mi		rpm database iterator
+ * @param tags		tags needed from the headers
+ * @param ntags		number of tags
+ * @return		1 if summaries are used, 0 otherwise
+ */
+RPM_GNUC_INTERNAL
+int rpmdbSetIteratorSummary(rpmdbMatchIterator mi,
+			    const rpmTagVal *tags, int ntags);
+
 #endif
@@ -8,6 +8,7 @@
 #include <unordered_map>
 #include <vector>
 #include <memory>
+#include <mutex>
 #include <atomic>
 
 #include <rpm/rpmlog.h>
@@ -109,6 +110,8 @@ struct rpmfiles_s {
     rpm_flag_t * vflags;	/*!< File verify flag(s) (from header) */
 
     rpmfiFlags fiflags;		/*!< file info set control flags */
+    std::atomic<rpmfiFlags> lazyflags; /*!< columns not yet loaded */
+    std::mutex lazylock;	/*!< serialize lazy column loading */
 
     struct fingerPrint * fps;	/*!< File fingerprint(s). */
 
@@ -127,6 +130,7 @@ struct rpmfiles_s {
 };
 
 static int indexSane(rpmtd xd, rpmtd yd, rpmtd zd);
+static void rpmfilesLoad(rpmfiles fi, rpmfiFlags col);
 static int cmpPoolFn(rpmstrPool pool, rpmfn files, int ix, const char * fn);
 
 rpmfiles rpmfilesLink(rpmfiles fi)
@@ -535,6 +539,7 @@ const unsigned char * rpmfilesFDigest(rpmfiles fi, int ix, int *algo, size_t *le
 
     if (fi != NULL && ix >= 0 && ix < rpmfilesFC(fi)) {
     	size_t diglen = rpmDigestLength(fi->digestalgo);
+	rpmfilesLoad(fi, RPMFI_NOFILEDIGESTS);
 	if (fi->digests != NULL)
 	    digest = fi->digests + (diglen * ix);
 	if (len) 
@@ -562,6 +567,7 @@ const unsigned char * rpmfilesFSignature(rpmfiles fi, int ix, size_t *len)
 
     if (fi != NULL && ix >= 0 && ix < rpmfilesFC(fi)) {
 	size_t slen = 0;
+	rpmfilesLoad(fi, RPMFI_NOFILESIGNATURES);
 	if (fi->signatures != NULL && fi->signatureoffs != NULL) {
 	    uint32_t off = fi->signatureoffs[ix];
 	    slen = fi->signatureoffs[ix+1] - off;
@@ -580,6 +586,7 @@ const unsigned char * rpmfilesVSignature(rpmfiles fi, int ix, size_t *len,
     const unsigned char *vsignature = NULL;
 
     if (fi != NULL && ix >= 0 && ix < rpmfilesFC(fi)) {
+	rpmfilesLoad(fi, RPMFI_NOVERITYSIGNATURES);
 	if (fi->veritysigs != NULL)
 	    vsignature = fi->veritysigs + (fi->veritysiglength * ix);
 	if (len)
@@ -595,6 +602,7 @@ const char * rpmfilesFLink(rpmfiles fi, int ix)
     const char * flink = NULL;
 
     if (fi != NULL && ix >= 0 && ix < rpmfilesFC(fi)) {
+	rpmfilesLoad(fi, RPMFI_NOFILELINKTOS);
 	if (fi->flinks != NULL)
 	    flink = rpmstrPoolStr(fi->pool, fi->flinks[ix]);
     }
@@ -630,6 +638,7 @@ rpm_ino_t rpmfilesFInode(rpmfiles fi, int ix)
     rpm_ino_t finode = 0;
 
     if (fi != NULL && ix >= 0 && ix < rpmfilesFC(fi)) {
+	rpmfilesLoad(fi, RPMFI_NOFILEINODES);
 	if (fi->finodes != NULL)
 	    finode = fi->finodes[ix];
     }
@@ -718,6 +727,7 @@ uint32_t rpmfilesFLinks(rpmfiles fi, int ix, const int ** files)
 
     if (fi != NULL && ix >= 0 && ix < rpmfilesFC(fi)) {
 	nlink = 1;
+	rpmfilesLoad(fi, RPMFI_NOFILEINODES);
 	if (fi->nlinks) {
 	    auto entry = fi->nlinks->find(ix);
 	    if (entry != fi->nlinks->end()) {
@@ -759,6 +769,7 @@ const char * rpmfilesFUser(rpmfiles fi, int ix)
     const char * fuser = NULL;
 
     if (fi != NULL && ix >= 0 && ix < rpmfilesFC(fi)) {
+	rpmfilesLoad(fi, RPMFI_NOFILEUSER);
 	if (fi->fuser != NULL)
 	    fuser = rpmstrPoolStr(fi->pool, fi->fuser[ix]);
     }
@@ -770,6 +781,7 @@ const char * rpmfilesFGroup(rpmfiles fi, int ix)
     const char * fgroup = NULL;
 
     if (fi != NULL && ix >= 0 && ix < rpmfilesFC(fi)) {
+	rpmfilesLoad(fi, RPMFI_NOFILEGROUP);
 	if (fi->fgroup != NULL)
 	    fgroup = rpmstrPoolStr(fi->pool, fi->fgroup[ix]);
     }
@@ -1564,6 +1576,67 @@ static uint8_t *base2bin(Header h, rpmTagVal tag, rpm_count_t num, int *len)
     return bin;
 }
 
+/*
+ * Load the (expensive to convert) columns in cols. These can be
+ * deferred to first access in RPMFI_LAZYLOAD mode.
+ */
+static int rpmfilesPopulateLazy(rpmfiles fi, Header h, rpmfiFlags cols)
+{
+    headerGetFlags scareFlags = (fi->fiflags & RPMFI_KEEPHEADER) ?
+				HEADERGET_MINMEM : HEADERGET_ALLOC;
+    struct rpmtd_s td;
+    rpm_count_t totalfc = rpmfilesFC(fi);
+
+    if (cols & RPMFI_NOFILELINKTOS)
+	fi->flinks = tag2pool(fi->pool, h, RPMTAG_FILELINKTOS, totalfc);
+
+    /* grab hex digests from header and store in binary format */
+    if (cols & RPMFI_NOFILEDIGESTS) {
+	size_t diglen = rpmDigestLength(fi->digestalgo);
+	fi->digests = hex2bin(h, RPMTAG_FILEDIGESTS, totalfc, diglen);
+    }
+
+    /* grab hex signatures from header and store in binary format */
+    if (cols & RPMFI_NOFILESIGNATURES) {
+	fi->signatures = hex2binv(h, RPMTAG_FILESIGNATURES,
+				 totalfc, &fi->signatureoffs);
+    }
+
+    if (cols & RPMFI_NOVERITYSIGNATURES) {
+	fi->verityalgo = headerGetNumber(h, RPMTAG_VERITYSIGNATUREALGO);
+	fi->veritysigs = base2bin(h, RPMTAG_VERITYSIGNATURES,
+				  totalfc, &fi->veritysiglength);
+    }
+
+    if (cols & RPMFI_NOFILEINODES) {
+	_hgfi(h, RPMTAG_FILEINODES, &td, scareFlags, fi->finodes);
+	rpmfilesBuildNLink(fi, h);
+    }
+    if (cols & RPMFI_NOFILEUSER) {
+	fi->fuser = tag2pool(fi->pool, h, RPMTAG_FILEUSERNAME, totalfc);
+	if (!fi->fuser) goto err;
+    }
+    if (cols & RPMFI_NOFILEGROUP) {
+	fi->fgroup = tag2pool(fi->pool, h, RPMTAG_FILEGROUPNAME, totalfc);
+	if (!fi->fgroup) goto err;
+    }
+    return 0;
+ err:
+    return -1;
+}
+
+/* Materialize a lazily loaded column on first access */
+static void rpmfilesLoad(rpmfiles fi, rpmfiFlags col)
+{
+    if (fi->lazyflags & col) {
+	std::lock_guard<std::mutex> lock(fi->lazylock);
+	if (fi->lazyflags & col) {
+	    rpmfilesPopulateLazy(fi, fi->h, col);
+	    fi->lazyflags &= ~col;
+	}
+    }
+}
+
 static int rpmfilesPopulate(rpmfiles fi, Header h, rpmfiFlags flags)
 {
     headerGetFlags scareFlags = (flags & RPMFI_KEEPHEADER) ? 
@@ -1609,8 +1682,6 @@ static int rpmfilesPopulate(rpmfiles fi, Header h, rpmfiFlags flags)
     if (!(flags & RPMFI_NOFILECAPS))
 	_hgfi(h, RPMTAG_FILECAPS, &td, defFlags, fi->fcaps);
 
-    if (!(flags & RPMFI_NOFILELINKTOS))
-	fi->flinks = tag2pool(fi->pool, h, RPMTAG_FILELINKTOS, totalfc);
     /* FILELANGS are only interesting when installing */
     if ((headerGetInstance(h) == 0) && !(flags & RPMFI_NOFILELANGS))
 	fi->flangs = tag2pool(fi->pool, h, RPMTAG_FILELANGS, totalfc);
@@ -1625,44 +1696,19 @@ static int rpmfilesPopulate(rpmfiles fi, Header h, rpmfiFlags flags)
 	}
     }
 
-    fi->digests = NULL;
-    /* grab hex digests from header and store in binary format */
-    if (!(flags & RPMFI_NOFILEDIGESTS)) {
-	size_t diglen = rpmDigestLength(fi->digestalgo);
-	fi->digests = hex2bin(h, RPMTAG_FILEDIGESTS, totalfc, diglen);
-    }
-
-    fi->signatures = NULL;
-    /* grab hex signatures from header and store in binary format */
-    if (!(flags & RPMFI_NOFILESIGNATURES)) {
-	fi->signatures = hex2binv(h, RPMTAG_FILESIGNATURES,
-				 totalfc, &fi->signatureoffs);
-    }
-
-    fi->veritysigs = NULL;
-    if (!(flags & RPMFI_NOVERITYSIGNATURES)) {
-	fi->verityalgo = headerGetNumber(h, RPMTAG_VERITYSIGNATUREALGO);
-	fi->veritysigs = base2bin(h, RPMTAG_VERITYSIGNATURES,
-				  totalfc, &fi->veritysiglength);
-    }
-
     /* XXX TR_REMOVED doesn;t need fmtimes, frdevs, finodes */
     if (!(flags & RPMFI_NOFILEMTIMES))
 	_hgfi(h, RPMTAG_FILEMTIMES, &td, scareFlags, fi->fmtimes);
     if (!(flags & RPMFI_NOFILERDEVS))
 	_hgfi(h, RPMTAG_FILERDEVS, &td, scareFlags, fi->frdevs);
-    if (!(flags & RPMFI_NOFILEINODES)) {
-	_hgfi(h, RPMTAG_FILEINODES, &td, scareFlags, fi->finodes);
-	rpmfilesBuildNLink(fi, h);
-    }
-    if (!(flags & RPMFI_NOFILEUSER)) {
-	fi->fuser = tag2pool(fi->pool, h, RPMTAG_FILEUSERNAME, totalfc);
-	if (!fi->fuser) goto err;
-    }
-    if (!(flags & RPMFI_NOFILEGROUP)) {
-	fi->fgroup = tag2pool(fi->pool, h, RPMTAG_FILEGROUPNAME, totalfc);
-	if (!fi->fgroup) goto err;
-    }
+
+    /* Defer the costly columns to first use if requested */
+    if (flags & RPMFI_LAZYLOAD)
+	fi->lazyflags = RPMFI_LAZY_COLUMNS & ~flags;
+
+    if (rpmfilesPopulateLazy(fi, h, RPMFI_LAZY_COLUMNS & ~flags & ~fi->lazyflags))
+	goto err;
+
     /* TODO: validate and return a real error */
     return 0;
  err:
@@ -1674,6 +1720,10 @@ rpmfiles rpmfilesNew(rpmstrPool pool, Header h, rpmTagVal tagN, rpmfiFlags flags
     rpmfiles fi = new rpmfiles_s {};
     int fc;
 
+    /* Lazy loading needs the header and a private pool to add to */
+    if (!(flags & RPMFI_KEEPHEADER) || pool != NULL)
+	flags &= ~RPMFI_LAZYLOAD;
+
     fi->magic = RPMFIMAGIC;
     fi->fiflags = flags;
     /* private or shared pool? */
@@ -1709,7 +1759,7 @@ rpmfiles rpmfilesNew(rpmstrPool pool, Header h, rpmTagVal tagN, rpmfiFlags flags
     }
 
     /* freeze the pool to save memory, but only if private pool */
-    if (fi->pool != pool)
+    if (fi->pool != pool && fi->lazyflags == 0)
 	rpmstrPoolFreeze(fi->pool, 0);
 
     fi->h = (fi->fiflags & RPMFI_KEEPHEADER) ? headerLink(h) : NULL;
@@ -2331,14 +2381,12 @@ int rpmfiArchiveReadToFilePsm(rpmfi fi, FD_t fd, int nodigest, rpmpsm psm)
 	return -1;
 
     rpm_loff_t left = rpmfiFSize(fi);
-    const unsigned char * fidigest = NULL;
     int digestalgo = 0;
     int rc = 0;
     char buf[BUFSIZ*4];
 
     if (!nodigest) {
 	digestalgo = rpmfiDigestAlgo(fi);
-	fidigest = rpmfilesFDigest(fi->files, rpmfiFX(fi), NULL, NULL);
 	fdInitDigest(fd, digestalgo, 0);
     }
 
@@ -2363,26 +2411,35 @@ int rpmfiArchiveReadToFilePsm(rpmfi fi, FD_t fd, int nodigest, rpmpsm psm)
 
 	(void) Fflush(fd);
 	fdFiniDigest(fd, digestalgo, &digest, NULL, 0);
+	rc = rpmfilesCheckFDigest(fi->files, rpmfiFX(fi), digestalgo, digest);
+	free(digest);
+    }
 
-	if (digest != NULL && fidigest != NULL) {
-	    size_t diglen = rpmDigestLength(digestalgo);
-	    if (memcmp(digest, fidigest, diglen)) {
-		rc = RPMERR_DIGEST_MISMATCH;
+exit:
+    return rc;
+}
 
-		/* ...but in old packages, empty files have zeros for digest */
-		if (rpmfiFSize(fi) == 0 && digestalgo == RPM_HASH_MD5) {
-		    std::vector<uint8_t> zeros(diglen, 0);
-		    if (memcmp(zeros.data(), fidigest, diglen) == 0)
-			rc = 0;
-		}
-	    }
-	} else {
+int rpmfilesCheckFDigest(rpmfiles files, int ix, int digestalgo,
+			 const void *digest)
+{
+    const unsigned char *fidigest = rpmfilesFDigest(files, ix, NULL, NULL);
+    int rc = 0;
+
+    if (digest != NULL && fidigest != NULL) {
+	size_t diglen = rpmDigestLength(digestalgo);
+	if (memcmp(digest, fidigest, diglen)) {
 	    rc = RPMERR_DIGEST_MISMATCH;
+
+	    /* ...but in old packages, empty files have zeros for digest */
+	    if (rpmfilesFSize(files, ix) == 0 && digestalgo == RPM_HASH_MD5) {
+		std::vector<uint8_t> zeros(diglen, 0);
+		if (memcmp(zeros.data(), fidigest, diglen) == 0)
+		    rc = 0;
+	    }
 	}
-	free(digest);
+    } else {
+	rc = RPMERR_DIGEST_MISMATCH;
     }
-
-exit:
     return rc;
 }
 
@@ -9,6 +9,14 @@
 
 #define	RPMFIMAGIC	0x09697923
 
+/* Internal rpmfilesNew() flag: convert costly columns on first access only */
+#define RPMFI_LAZYLOAD	(1U << 31)
+
+#define RPMFI_LAZY_COLUMNS \
+    (RPMFI_NOFILEDIGESTS | RPMFI_NOFILESIGNATURES | \
+     RPMFI_NOVERITYSIGNATURES | RPMFI_NOFILELINKTOS | \
+     RPMFI_NOFILEINODES | RPMFI_NOFILEUSER | RPMFI_NOFILEGROUP)
+
 /** \ingroup rpmfi
  * Callback on file iterator directory changes
  * @param fi		file info
@@ -123,5 +131,17 @@ rpmfiles rpmfiFiles(rpmfi fi);
 RPM_GNUC_INTERNAL
 rpmfi rpmfilesFindPrefix(rpmfiles fi, const char *pfx);
 
+/** \ingroup rpmfi
+ * Compare calculated file content digest to the one in file info set.
+ * @param files		file info set
+ * @param ix		file index
+ * @param digestalgo	digest algorithm used to calculate digest
+ * @param digest	calculated (binary) digest
+ * @return		0 on match, RPMERR_DIGEST_MISMATCH otherwise
+ */
+RPM_GNUC_INTERNAL
+int rpmfilesCheckFDigest(rpmfiles files, int ix, int digestalgo,
+			 const void *digest);
+
 #endif	/* _RPMFI_INTERNAL_H */
 
@@ -1,6 +1,7 @@
 
 #include "system.h"
 
+#include <mutex>
 #include <vector>
 
 #include <rpm/rpmmacro.h>
@@ -30,6 +31,7 @@ struct rpmPlugin_s {
 struct rpmPlugins_s {
     vector<rpmPlugin> plugins;
     rpmts ts;
+    std::mutex fsmMutex; /* fsm hooks can be called from parallel installs */
 };
 
 static rpmPlugin rpmpluginsGetPlugin(rpmPlugins plugins, const char *name)
@@ -353,6 +355,7 @@ rpmRC rpmpluginsCallFsmFilePre(rpmPlugins plugins, rpmfi fi, const char *path,
     plugin_fsm_file_pre_func hookFunc;
     rpmRC rc = RPMRC_OK;
     char *apath = abspath(fi, path);
+    std::lock_guard<std::mutex> lock(plugins->fsmMutex);
 
     for (auto & plugin : plugins->plugins) {
 	RPMPLUGINS_SET_HOOK_FUNC(fsm_file_pre);
@@ -372,6 +375,7 @@ rpmRC rpmpluginsCallFsmFilePost(rpmPlugins plugins, rpmfi fi, const char *path,
     plugin_fsm_file_post_func hookFunc;
     rpmRC rc = RPMRC_OK;
     char *apath = abspath(fi, path);
+    std::lock_guard<std::mutex> lock(plugins->fsmMutex);
 
     for (auto & plugin : plugins->plugins) {
 	RPMPLUGINS_SET_HOOK_FUNC(fsm_file_post);
@@ -391,6 +395,7 @@ rpmRC rpmpluginsCallFsmFilePrepare(rpmPlugins plugins, rpmfi fi,
     plugin_fsm_file_prepare_func hookFunc;
     rpmRC rc = RPMRC_OK;
     char *apath = abspath(fi, path);
+    std::lock_guard<std::mutex> lock(plugins->fsmMutex);
 
     for (auto & plugin : plugins->plugins) {
 	RPMPLUGINS_SET_HOOK_FUNC(fsm_file_prepare);
@@ -757,3 +757,8 @@ rpmscriptFlags rpmScriptFlags(rpmScript script)
 {
     return (script != NULL) ? script->flags : 0;
 }
+
+const char *rpmScriptDescr(rpmScript script)
+{
+    return (script != NULL) ? script->descr : NULL;
+}
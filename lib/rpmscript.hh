@@ -82,6 +82,9 @@ rpmscriptTypes rpmScriptType(rpmScript script);
 RPM_GNUC_INTERNAL
 rpmscriptFlags rpmScriptFlags(rpmScript script);
 
+RPM_GNUC_INTERNAL
+const char *rpmScriptDescr(rpmScript script);
+
 RPM_GNUC_INTERNAL
 void rpmScriptSetNextFileFunc(rpmScript script, nextfilefunc func,
 			    void *param);
@@ -65,6 +65,8 @@ struct rpmte_s {
     int nrelocs;		/*!< (TR_ADDED) No. of relocations. */
     uint8_t *badrelocs;		/*!< (TR_ADDED) Bad relocations (or NULL) */
     FD_t fd;			/*!< (TR_ADDED) Payload file descriptor. */
+    int fdowned;		/*!< (TR_ADDED) fd is our own duplicate? */
+    int overlapped;		/*!< (TR_ADDED) creates files of earlier elements? */
     int vfylevel;		/*!< (TR_ADDED) Per-pkg verify level (if any) */
     int verified;		/*!< (TR_ADDED) Verification status */
     int addop;			/*!< (TR_ADDED) RPMTE_INSTALL/UPDATE/REINSTALL */
@@ -73,10 +75,14 @@ struct rpmte_s {
 #define RPMTE_HAVE_POSTTRANS	(1 << 1)
 #define RPMTE_HAVE_PREUNTRANS	(1 << 2)
 #define RPMTE_HAVE_POSTUNTRANS	(1 << 3)
-    int transscripts;		/*!< pre/posttrans script existence */
+#define RPMTE_HAVE_INSTSCRIPTS	(1 << 4)
+    int transscripts;		/*!< script existence flags */
     int failed;			/*!< (parent) install/erase failed */
 
     rpmfs fs;
+
+    struct rpmop_s ops[RPMTE_OP_MAX];	/*!< Per-element operation timings */
+    rpmteScriptTimes scripttimes;	/*!< Scriptlet timings */
 };
 
 /* forward declarations */
@@ -215,6 +221,20 @@ static int addTE(rpmte p, Header h, fnpyKey key, rpmRelocation * relocs)
 			 headerIsEntry(h, RPMTAG_POSTUNTRANSPROG)) ?
 			RPMTE_HAVE_POSTUNTRANS : 0;
 
+    /* See if there's anything to do besides laying down the files */
+    for (rpmTagVal tag : {
+	    RPMTAG_PREIN, RPMTAG_PREINPROG, RPMTAG_POSTIN, RPMTAG_POSTINPROG,
+	    RPMTAG_TRIGGERNAME, RPMTAG_FILETRIGGERNAME
+	}) {
+	if (headerIsEntry(h, tag))
+	    p->transscripts |= RPMTE_HAVE_INSTSCRIPTS;
+    }
+    for (rpmds ds = rpmdsInit(p->dependencies[RPMTAG_PROVIDENAME]);
+	    rpmdsNext(ds) >= 0; ) {
+	if (rpmdsIsSysuser(ds, NULL))
+	    p->transscripts |= RPMTE_HAVE_INSTSCRIPTS;
+    }
+
     rpmteColorDS(p, RPMTAG_PROVIDENAME);
     rpmteColorDS(p, RPMTAG_REQUIRENAME);
 
@@ -615,7 +635,11 @@ static int rpmteClose(rpmte te, int reset_fi)
 
     switch (te->type) {
     case TR_ADDED:
-	if (te->fd) {
+	if (te->fd && te->fdowned) {
+	    Fclose(te->fd);
+	    te->fd = NULL;
+	    te->fdowned = 0;
+	} else if (te->fd) {
 	    rpmtsNotify(te->ts, te, RPMCALLBACK_INST_CLOSE_FILE, 0, 0);
 	    te->fd = NULL;
 	}
@@ -636,6 +660,27 @@ static int rpmteClose(rpmte te, int reset_fi)
     return 1;
 }
 
+/*
+ * Replace the package descriptor of an open element with a duplicate and
+ * hand the original back to the application, which can only handle one
+ * open package at a time. Returns 0 if the application's descriptor has
+ * to stay open.
+ */
+static int rpmteDetachFd(rpmte te)
+{
+    FD_t fd = NULL;
+
+    if (te->fd == NULL || te->fdowned)
+	return 1;
+    if (Fileno(te->fd) < 0 || (fd = fdDup(Fileno(te->fd))) == NULL)
+	return 0;
+
+    rpmtsNotify(te->ts, te, RPMCALLBACK_INST_CLOSE_FILE, 0, 0);
+    te->fd = fd;
+    te->fdowned = 1;
+    return 1;
+}
+
 FD_t rpmtePayload(rpmte te)
 {
     FD_t payload = NULL;
@@ -689,6 +734,21 @@ int rpmteHaveTransScript(rpmte te, rpmTagVal tag)
     return rc;
 }
 
+int rpmteHaveInstScripts(rpmte te)
+{
+    return (te->transscripts & RPMTE_HAVE_INSTSCRIPTS) ? 1 : 0;
+}
+
+int rpmteOverlapped(rpmte te)
+{
+    return te->overlapped;
+}
+
+void rpmteSetOverlapped(rpmte te, int overlapped)
+{
+    te->overlapped = overlapped;
+}
+
 rpmps rpmteProblems(rpmte te)
 {
     return (te != NULL) ? rpmpsLink(te->probs) : NULL;
@@ -785,6 +845,20 @@ void rpmteSetVerified(rpmte te, int verified)
     te->verified = verified;
 }
 
+rpmop rpmteOp(rpmte te, rpmteOpX opx)
+{
+    rpmop op = NULL;
+
+    if (te != NULL && opx >= 0 && opx < RPMTE_OP_MAX)
+	op = te->ops + opx;
+    return op;
+}
+
+rpmteScriptTimes & rpmteScriptTimings(rpmte te)
+{
+    return te->scripttimes;
+}
+
 int rpmteVerified(rpmte te)
 {
     return (te != NULL) ? te->verified : 0;
@@ -841,3 +915,42 @@ int rpmteProcess(rpmte te, pkgGoal goal, int num)
 
     return failed;
 }
+
+void rpmteProcessInstalls(rpmte *tes, int n, int num, int nthreads,
+			  int *failed)
+{
+    rpmts ts = tes[0]->ts;
+    std::vector<rpmRC> rcs(n, RPMRC_FAIL);
+    std::vector<int> opened(n);
+    int i = 0;
+
+    while (i < n) {
+	int j;
+
+	/*
+	 * Elements are opened in order and closed again right away, the
+	 * unpack works on a duplicate of the descriptor. One that can't
+	 * be duplicated stays open and ends the batch.
+	 */
+	for (j = i; j < n; j++) {
+	    opened[j] = rpmteOpen(tes[j], 1);
+	    if (opened[j]) {
+		rpmtsNotify(ts, tes[j], RPMCALLBACK_ELEM_PROGRESS, num + j,
+			    rpmtsMembers(ts)->order.size());
+		rcs[j] = RPMRC_OK;
+		if (!rpmteDetachFd(tes[j])) {
+		    j++;
+		    break;
+		}
+	    }
+	}
+
+	rpmpsmRunInstalls(ts, tes + i, rcs.data() + i, j - i, nthreads);
+
+	for (; i < j; i++) {
+	    if (opened[i])
+		rpmteClose(tes[i], 1);
+	    failed[i] = rcs[i] ? rpmteMarkFailed(tes[i]) : 0;
+	}
+    }
+}
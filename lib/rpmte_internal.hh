@@ -6,6 +6,32 @@
 #include <rpm/rpmtag.h>
 #include "rpmfs.hh"
 
+#include <string>
+#include <vector>
+
+/** \ingroup rpmte
+ * Per-element operation timing indices.
+ */
+typedef enum rpmteOpX_e {
+    RPMTE_OP_VERIFY		=  0,
+    RPMTE_OP_UNPACK		=  1,
+    RPMTE_OP_ERASE		=  2,
+    RPMTE_OP_SCRIPTLETS		=  3,
+    RPMTE_OP_TRIGGERS		=  4,
+    RPMTE_OP_DBADD		=  5,
+    RPMTE_OP_DBREMOVE		=  6,
+    RPMTE_OP_SYNC		=  7,
+    RPMTE_OP_MAX		=  8
+} rpmteOpX;
+
+/* Timing of a single scriptlet run */
+struct rpmteScriptTime_s {
+    std::string descr;
+    rpmtime_t usecs;
+};
+
+typedef std::vector<rpmteScriptTime_s> rpmteScriptTimes;
+
 typedef enum pkgGoal_e {
     PKG_NONE		= 0,
     /* permit using rpmteType() for install + erase goals */
@@ -70,6 +96,21 @@ FD_t rpmtePayload(rpmte te);
 RPM_GNUC_INTERNAL
 int rpmteProcess(rpmte te, pkgGoal goal, int num);
 
+/**
+ * Install a batch of transaction elements, unpacking their payloads
+ * concurrently. The elements must not have install scriptlets or
+ * triggers, see rpmteHaveInstScripts(), nor create the same files,
+ * see rpmteOverlapped().
+ * @param tes		array of (added) transaction elements
+ * @param n		number of elements
+ * @param num		transaction order index of the first element
+ * @param nthreads	maximum number of concurrent unpacks
+ * @param[out] failed	per-element failure status (as rpmteProcess())
+ */
+RPM_GNUC_INTERNAL
+void rpmteProcessInstalls(rpmte *tes, int n, int num, int nthreads,
+			  int *failed);
+
 RPM_GNUC_INTERNAL
 void rpmteAddProblem(rpmte te, rpmProblemType type,
                      const char *altNEVR, const char *str, uint64_t number);
@@ -93,12 +134,50 @@ void rpmteSetTSI(rpmte te, tsortInfo tsi);
 RPM_GNUC_INTERNAL
 int rpmteHaveTransScript(rpmte te, rpmTagVal tag);
 
+/**
+ * Does the element have install scriptlets, triggers or sysusers?
+ * @param te		transaction element
+ * @return		1 if any are present, 0 otherwise
+ */
+RPM_GNUC_INTERNAL
+int rpmteHaveInstScripts(rpmte te);
+
+/**
+ * Does the element create files that an earlier element in the
+ * transaction creates too (eg. with --replacefiles)? Such elements
+ * must not be unpacked concurrently with the earlier ones.
+ * @param te		transaction element
+ * @return		1 if overlapped, 0 otherwise
+ */
+RPM_GNUC_INTERNAL
+int rpmteOverlapped(rpmte te);
+
+RPM_GNUC_INTERNAL
+void rpmteSetOverlapped(rpmte te, int overlapped);
+
 /* XXX should be internal too but build code needs for now... */
 rpmfs rpmteGetFileStates(rpmte te);
 
 RPM_GNUC_INTERNAL
 void rpmteSetVerified(rpmte te, int verified);
 
+/** \ingroup rpmte
+ * Retrieve per-element operation timestamp.
+ * @param te		transaction element
+ * @param opx		operation timestamp index
+ * @return		pointer to operation timestamp
+ */
+RPM_GNUC_INTERNAL
+rpmop rpmteOp(rpmte te, rpmteOpX opx);
+
+/** \ingroup rpmte
+ * Retrieve the scriptlets run on behalf of an element and their timings.
+ * @param te		transaction element
+ * @return		scriptlet timings (in run order)
+ */
+RPM_GNUC_INTERNAL
+rpmteScriptTimes & rpmteScriptTimings(rpmte te);
+
 RPM_GNUC_INTERNAL
 Header rpmteHeaderAux(rpmte te, int init);
 
@@ -120,6 +199,18 @@ unsigned int rpmteHeaderSize(rpmte te);
 RPM_GNUC_INTERNAL
 rpmRC rpmpsmRun(rpmts ts, rpmte te, pkgGoal goal);
 
+/**
+ * Install several elements, unpacking their payloads concurrently.
+ * Elements with non-zero rcs on entry are skipped.
+ * @param ts		transaction set
+ * @param tes		array of transaction elements
+ * @param rcs		per-element result codes (in/out)
+ * @param n		number of elements
+ * @param nthreads	maximum number of concurrent unpacks
+ */
+RPM_GNUC_INTERNAL
+void rpmpsmRunInstalls(rpmts ts, rpmte *tes, rpmRC *rcs, int n, int nthreads);
+
 RPM_GNUC_INTERNAL
 int rpmteAddOp(rpmte te);
 
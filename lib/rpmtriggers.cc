@@ -465,6 +465,34 @@ static bool skipFileTrigger(rpmts ts, rpmsenseFlags sense,
     return skip;
 }
 
+std::vector<std::string> rpmtriggersFilePrefixes(rpmts ts)
+{
+    std::vector<std::string> pfxs;
+    rpmdbIndexIterator ii;
+    const void *key;
+    size_t keylen;
+
+    ii = rpmdbIndexIteratorInit(rpmtsGetRdb(ts), RPMDBI_FILETRIGGERNAME);
+    while ((rpmdbIndexIteratorNext(ii, &key, &keylen)) == 0)
+	pfxs.emplace_back((const char *)key, keylen);
+    rpmdbIndexIteratorFree(ii);
+
+    return pfxs;
+}
+
+int rpmtriggersMatchPkgFiles(rpmts ts, rpmte te,
+			     const std::vector<std::string> & pfxs)
+{
+    int match = 0;
+
+    for (auto const & pfx : pfxs) {
+	if ((match = matchFilesInPkg(ts, te, pfx.c_str(), 0)))
+	    break;
+    }
+
+    return match;
+}
+
 rpmRC runFileTriggers(rpmts ts, rpmte te, int arg2, rpmsenseFlags sense,
 			rpmscriptTriggerModes tm, int priorityClass)
 {
@@ -2,7 +2,9 @@
 #define _RPMTRIGGERS_H
 
 #include <set>
+#include <string>
 #include <tuple>
+#include <vector>
 
 #include <rpm/rpmutil.h>
 #include "rpmscript.hh"
@@ -37,6 +39,25 @@ using rpmtriggers = std::set<triggerInfo>;
 RPM_GNUC_INTERNAL
 void rpmtriggersPrepPostUnTransFileTrigs(rpmts ts, rpmte te);
 
+/*
+ * Return the prefixes of all file triggers in rpmdb
+ * @param ts		transaction set
+ * @return		file trigger prefixes
+ */
+RPM_GNUC_INTERNAL
+std::vector<std::string> rpmtriggersFilePrefixes(rpmts ts);
+
+/*
+ * Check whether any of the file trigger prefixes matches files in te
+ * @param ts		transaction set
+ * @param te		transaction element
+ * @param pfxs		file trigger prefixes, see rpmtriggersFilePrefixes()
+ * @return		1 on match, 0 otherwise
+ */
+RPM_GNUC_INTERNAL
+int rpmtriggersMatchPkgFiles(rpmts ts, rpmte te,
+			     const std::vector<std::string> & pfxs);
+
 /* Run triggers stored in ts */
 RPM_GNUC_INTERNAL
 int runPostUnTransFileTrigs(rpmts ts);
@@ -188,6 +188,19 @@ int rpmtsVerifyDB(rpmts ts)
     return rc;
 }
 
+int rpmtsCompactDB(rpmts ts)
+{
+    int rc = -1;
+    rpmtxn txn = rpmtxnBegin(ts, RPMTXN_WRITE);
+    if (txn) {
+	rc = rpmtsOpenDB(ts, O_RDWR);
+	if (!rc)
+	    rc = rpmdbCtrl(ts->rdb, RPMDB_CTRL_COMPACT);
+	rpmtxnEnd(txn);
+    }
+    return rc;
+}
+
 /* keyp might no be defined. */
 rpmdbMatchIterator rpmtsInitIterator(const rpmts ts, rpmDbiTagVal rpmtag,
 			const void * keyp, size_t keylen)
@@ -567,6 +580,7 @@ void rpmtsEmpty(rpmts ts)
 
     rpmtsClean(ts);
     ts->trigs2run.clear();
+    ts->scripttimes.clear();
 
     for (auto & te : tsmem->order) {
 	rpmtsNotifyChange(ts, RPMTS_EVENT_DEL, te, NULL);
@@ -611,6 +625,112 @@ static void rpmtsPrintStats(rpmts ts)
     rpmtsPrintStat("dbget:       ", rpmtsOp(ts, RPMTS_OP_DBGET));
     rpmtsPrintStat("dbput:       ", rpmtsOp(ts, RPMTS_OP_DBPUT));
     rpmtsPrintStat("dbdel:       ", rpmtsOp(ts, RPMTS_OP_DBDEL));
+    rpmtsPrintStat("sync:        ", rpmtsOp(ts, RPMTS_OP_SYNC));
+}
+
+static const struct {
+    const char *name;
+    rpmtsOpX opx;
+} tsOpNames[] = {
+    { "total",		RPMTS_OP_TOTAL },
+    { "check",		RPMTS_OP_CHECK },
+    { "order",		RPMTS_OP_ORDER },
+    { "verify",		RPMTS_OP_VERIFY },
+    { "fingerprint",	RPMTS_OP_FINGERPRINT },
+    { "install",	RPMTS_OP_INSTALL },
+    { "erase",		RPMTS_OP_ERASE },
+    { "scriptlets",	RPMTS_OP_SCRIPTLETS },
+    { "compress",	RPMTS_OP_COMPRESS },
+    { "uncompress",	RPMTS_OP_UNCOMPRESS },
+    { "digest",		RPMTS_OP_DIGEST },
+    { "signature",	RPMTS_OP_SIGNATURE },
+    { "dbadd",		RPMTS_OP_DBADD },
+    { "dbremove",	RPMTS_OP_DBREMOVE },
+    { "dbget",		RPMTS_OP_DBGET },
+    { "dbput",		RPMTS_OP_DBPUT },
+    { "dbdel",		RPMTS_OP_DBDEL },
+    { "sync",		RPMTS_OP_SYNC },
+};
+
+static const char * const teOpNames[RPMTE_OP_MAX] = {
+    "verify", "unpack", "erase", "scriptlets", "triggers",
+    "dbadd", "dbremove", "sync",
+};
+
+static void profileOp(string & js, const char *name, rpmop op)
+{
+    char *buf = NULL;
+
+    if (op == NULL || op->count == 0)
+	return;
+
+    if (js.back() != '{')
+	js += ", ";
+    rasprintf(&buf, "\"%s\": {\"count\": %d, \"bytes\": %zu, \"usecs\": %lu}",
+	      name, op->count, op->bytes, (unsigned long)op->usecs);
+    js += buf;
+    free(buf);
+}
+
+static void profileScripts(string & js, const rpmteScriptTimes & scripts)
+{
+    js += "[";
+    for (auto const & st : scripts) {
+	char *name = rpmJsonEscape(st.descr.c_str());
+	char *buf = NULL;
+	rasprintf(&buf, "{\"name\": %s, \"usecs\": %lu}",
+		  name, (unsigned long)st.usecs);
+	if (js.back() != '[')
+	    js += ", ";
+	js += buf;
+	free(buf);
+	free(name);
+    }
+    js += "]";
+}
+
+char * rpmtsProfile(rpmts ts)
+{
+    tsMembers tsmem = rpmtsMembers(ts);
+    string js;
+    char *buf = NULL;
+
+    if (ts == NULL)
+	return NULL;
+
+    rasprintf(&buf, "{\n  \"tid\": %u,\n  \"ops\": {", rpmtsGetTid(ts));
+    js += buf;
+    buf = _free(buf);
+    for (auto const & on : tsOpNames) {
+	struct rpmop_s op = *rpmtsOp(ts, on.opx);
+	/* The total is still running, don't disturb it */
+	if (on.opx == RPMTS_OP_TOTAL)
+	    (void) rpmswExit(&op, 0);
+	profileOp(js, on.name, &op);
+    }
+    js += "},\n  \"elements\": [";
+
+    for (auto const & te : tsmem->order) {
+	char *nevra = rpmJsonEscape(rpmteNEVRA(te));
+	if (js.back() != '[')
+	    js += ",";
+	rasprintf(&buf, "\n    {\"nevra\": %s, \"type\": \"%s\", \"ops\": {",
+		  nevra, rpmteType(te) == TR_ADDED ? "install" : "erase");
+	js += buf;
+	buf = _free(buf);
+	for (int i = 0; i < RPMTE_OP_MAX; i++)
+	    profileOp(js, teOpNames[i], rpmteOp(te, (rpmteOpX)i));
+	js += "}, \"scriptlets\": ";
+	profileScripts(js, rpmteScriptTimings(te));
+	js += "}";
+	free(nevra);
+    }
+
+    js += "\n  ],\n  \"scriptlets\": ";
+    profileScripts(js, ts->scripttimes);
+    js += "\n}\n";
+
+    return xstrdup(js.c_str());
 }
 
 rpmts rpmtsFree(rpmts ts)
@@ -15,6 +15,7 @@
 #include "rpmlock.hh"
 #include "rpmdb_internal.hh"
 #include "rpmscript.hh"
+#include "rpmte_internal.hh"
 #include "rpmtriggers.hh"
 
 struct diskspaceInfo {
@@ -31,6 +32,7 @@ struct diskspaceInfo {
     int64_t idelta;	/*!< Delta for temporary inode need on updates */
 
     int rotational;	/*!< Rotational media? */
+    int syncfd;		/*!< Descriptor for syncfs(2) (or -1) */
 };
 
 /* Transaction set elements information */
@@ -91,6 +93,7 @@ struct rpmts_s {
     ARGV_t installLangs;	/*!< From %{_install_langs} */
 
     struct rpmop_s ops[RPMTS_OP_MAX];
+    rpmteScriptTimes scripttimes; /*!< Scriptlets run without an element */
 
     rpmPlugins plugins;		/*!< Transaction plugins */
 
@@ -134,6 +137,14 @@ int rpmtsSolve(rpmts ts, rpmds key);
 RPM_GNUC_INTERNAL
 rpmRC rpmtsSetupTransactionPlugins(rpmts ts);
 
+/*
+ * Flush the filesystems affected by the transaction to disk. Works
+ * both in and outside the chroot, the filesystems are synced through
+ * descriptors opened when the transaction was prepared.
+ */
+RPM_GNUC_INTERNAL
+void rpmtsSync(rpmts ts);
+
 RPM_GNUC_INTERNAL
 rpmRC runScript(rpmts ts, rpmte te, Header h, ARGV_const_t prefixes,
 		       rpmScript script, int arg1, int arg2);
@@ -1,5 +1,6 @@
 #include "system.h"
 
+#include <mutex>
 #include <unordered_map>
 #include <string>
 #include <vector>
@@ -32,6 +33,9 @@ struct rpmug_s {
 
 static __thread struct rpmug_s *rpmug = NULL;
 
+/* The caches are per-thread but the getpw*() and getgr*() ones are not */
+static std::mutex nss_mutex;
+
 static const char *getpath(const char *bn, const char *dfl, char **dest)
 {
     if (*dest == NULL) {
@@ -182,6 +186,7 @@ int rpmugUid(const char * thisUname, uid_t * uid)
 
     auto it = rpmug->unameMap.find(thisUname);
     if (it == rpmug->unameMap.end()) {
+	std::lock_guard<std::mutex> lock(nss_mutex);
 	const char *path = pwfile();
 	long id;
 	if (path) {
@@ -213,6 +218,7 @@ int rpmugGid(const char * thisGname, gid_t * gid)
 
     auto it = rpmug->gnameMap.find(thisGname);
     if (it == rpmug->gnameMap.end()) {
+	std::lock_guard<std::mutex> lock(nss_mutex);
 	const char *path = grpfile();
 	long id;
 	if (path) {
@@ -243,6 +249,7 @@ const char * rpmugUname(uid_t uid)
     const char *retname = NULL;
     auto it = rpmug->uidMap.find(uid);
     if (it == rpmug->uidMap.end()) {
+	std::lock_guard<std::mutex> lock(nss_mutex);
 	const char *path = pwfile();
 	char *uname = NULL;
 
@@ -274,6 +281,7 @@ const char * rpmugGname(gid_t gid)
     const char *retname = NULL;
     auto it = rpmug->gidMap.find(gid);
     if (it == rpmug->gidMap.end()) {
+	std::lock_guard<std::mutex> lock(nss_mutex);
 	const char *path = grpfile();
 	char *gname = NULL;
 
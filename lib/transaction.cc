@@ -113,9 +113,11 @@ static int getRotational(const string dirName, dev_t dev)
     return rotational;
 }
 
+static void rpmtsFreeDSI(rpmts ts);
+
 static int rpmtsInitDSI(const rpmts ts)
 {
-    ts->dsi.clear();
+    rpmtsFreeDSI(ts);
     return 0;
 }
 
@@ -160,6 +162,12 @@ static diskspaceInfo *rpmtsCreateDSI(const rpmts ts, dev_t dev,
     /* Initialized on demand */
     dsi->rotational = -1;
 
+    /* We may be in a chroot now but not when syncing, keep it open */
+    dsi->syncfd = -1;
+#ifdef HAVE_SYNCFS
+    dsi->syncfd = open(dirName, O_RDONLY|O_CLOEXEC);
+#endif
+
     /* normalize block size to 4096 bytes if it is too big. */
     if (dsi->bsize > 4096) {
 	uint64_t old_size = dsi->bavail * dsi->bsize;
@@ -287,6 +295,10 @@ static void rpmtsFreeDSI(rpmts ts)
 {
     if (ts == NULL)
 	return;
+    for (auto & entry : ts->dsi) {
+	if (entry.second.syncfd >= 0)
+	    close(entry.second.syncfd);
+    }
     ts->dsi.clear();
 }
 
@@ -503,6 +515,7 @@ static void handleOverlappedFiles(rpmts ts, fingerPrintCache fpc, rpmte p, rpmfi
     int reportConflicts = !(rpmtsFilterFlags(ts) & RPMPROB_FILTER_REPLACENEWFILES);
     fingerPrint * fpList = rpmfilesFps(fi);
 
+    rpmteSetOverlapped(p, 0);
     for (i = 0; i < fc; i++) {
 	struct fingerPrint * fiFps;
 	int otherPkgNum, otherFileNum;
@@ -651,6 +664,11 @@ assert(otherFi != NULL);
 		if (rpmfsGetAction(fs, i) == FA_UNKNOWN)
 		    rpmfsSetAction(fs, i, FA_CREATE);
 	    }
+
+	    /* Both create the file, keep them out of the same unpack batch */
+	    if (otherTe != p && !XFA_SKIPPING(rpmfsGetAction(fs, i)) &&
+		    !XFA_SKIPPING(rpmfsGetAction(otherFs, otherFileNum)))
+		rpmteSetOverlapped(p, 1);
 	    break;
 
 	case TR_REMOVED:
@@ -1029,7 +1047,9 @@ rpmdbMatchIterator rpmFindBaseNamesInDB(rpmts ts, uint64_t fileCount)
 
 /* Check files in the transactions against the rpmdb
  * Lookup all files with the same basename in the rpmdb
- * and then check for matching finger prints
+ * and then check for matching finger prints. Full path lookups would
+ * miss conflicts through symlinked directories, so there's no file
+ * name index for this.
  * @param ts		transaction set
  * @param fpc		global finger print cache
  */
@@ -1124,7 +1144,8 @@ void checkInstalledFiles(rpmts ts, uint64_t fileCount, fingerPrintCache fpc)
 		case TR_ADDED:
 		    if (!otherFi) {
 			/* XXX What to do if this fails? */
-		        otherFi = rpmfilesNew(NULL, h, RPMTAG_BASENAMES, RPMFI_KEEPHEADER);
+		        otherFi = rpmfilesNew(NULL, h, RPMTAG_BASENAMES,
+					      RPMFI_KEEPHEADER|RPMFI_LAZYLOAD);
 		    }
 		    handleInstInstalledFile(ts, p, fi, recs[j].fileno,
 					    h, otherFi, fileNum, beingRemoved);
@@ -1266,45 +1287,132 @@ static void finiPkgDigests(FD_t fd, ARGI_t ids, Header auxh)
     argiFree(ids);
 }
 
-static int verifyPackage(rpmts ts, rpmte p, struct rpmvs_s *vs, int vfylevel)
+struct vfyjob_s {
+    rpmte p;
+    FD_t fd;
+    Header auxh;
+    struct rpmvs_s *vs;
+    struct vfydata_s vd;
+    int prc;
+    int dupfd;		/* fd is our own copy of the application's */
+    int done;		/* already read and verified */
+};
+
+static void verifyPackageRead(rpmts ts, struct vfyjob_s *job);
+
+/*
+ * Set up verification of an element, this calls back into the application.
+ * Applications can only handle one open package at a time, so the package
+ * is closed again before returning. With detach set, a duplicate of the
+ * descriptor is kept for reading the package later, otherwise the package
+ * is read and verified right away.
+ */
+static void verifyPackageOpen(rpmts ts, struct vfyjob_s *job,
+			      rpmVSFlags vsflags, rpmKeyring keyring,
+			      int detach)
 {
-    struct vfydata_s vd = {
-	.msg = NULL,
-	.type = { -1, -1, -1, },
-	.vfylevel = vfylevel,
-    };
-    int verified = 0;
-    int prc = RPMRC_FAIL;
-    Header auxh = rpmteHeaderAux(p, 1);
+    rpmte p = job->p;
+    FD_t fd;
+
+    job->vd.msg = NULL;
+    job->vd.vfylevel = rpmteVfyLevel(p);
+    for (int i = 0; i < 3; i++)
+	job->vd.type[i] = -1;
+    job->prc = RPMRC_FAIL;
+    job->auxh = rpmteHeaderAux(p, 1);
+    job->vs = rpmvsCreate(job->vd.vfylevel, vsflags, keyring);
+    fd = (FD_t)rpmtsNotify(ts, p, RPMCALLBACK_INST_OPEN_FILE, 0, 0);
+
+    if (fd != NULL && detach && Fileno(fd) >= 0)
+	job->fd = fdDup(Fileno(fd));
+
+    if (job->fd != NULL) {
+	job->dupfd = 1;
+    } else {
+	job->fd = fd;
+	verifyPackageRead(ts, job);
+	job->fd = NULL;
+	job->done = 1;
+    }
 
-    FD_t fd = (FD_t)rpmtsNotify(ts, p, RPMCALLBACK_INST_OPEN_FILE, 0, 0);
-    if (fd != NULL) {
-	ARGI_t ids = initPkgDigests(fd);
-	prc = rpmpkgRead(vs, fd, NULL, NULL, &vd.msg);
-	int test = rpmtsFlags(ts) & RPMTRANS_FLAG_TEST;
-	finiPkgDigests(fd, ids, (test || prc) ? NULL : auxh);
+    if (fd != NULL)
 	rpmtsNotify(ts, p, RPMCALLBACK_INST_CLOSE_FILE, 0, 0);
+}
+
+/* Read and verify the package, this can run in parallel for elements */
+static void verifyPackageRead(rpmts ts, struct vfyjob_s *job)
+{
+    if (job->done)
+	return;
+
+    (void) rpmswEnter(rpmteOp(job->p, RPMTE_OP_VERIFY), 0);
+    if (job->fd != NULL) {
+	ARGI_t ids = initPkgDigests(job->fd);
+	job->prc = rpmpkgRead(job->vs, job->fd, NULL, NULL, &job->vd.msg);
+	int test = rpmtsFlags(ts) & RPMTRANS_FLAG_TEST;
+	finiPkgDigests(job->fd, ids, (test || job->prc) ? NULL : job->auxh);
     }
 
-    if (prc == RPMRC_OK)
-	prc = rpmvsVerify(vs, RPMSIG_VERIFIABLE_TYPE, vfyCb, &vd);
+    if (job->prc == RPMRC_OK)
+	job->prc = rpmvsVerify(job->vs, RPMSIG_VERIFIABLE_TYPE, vfyCb, &job->vd);
+    (void) rpmswExit(rpmteOp(job->p, RPMTE_OP_VERIFY), 0);
+}
+
+/* Record verify result */
+static int verifyPackageClose(rpmts ts, struct vfyjob_s *job)
+{
+    rpmte p = job->p;
+    int verified = 0;
+
+    if (job->dupfd) {
+	Fclose(job->fd);
+	job->fd = NULL;
+    }
 
-    /* Record verify result */
-    if (vd.type[RPMSIG_SIGNATURE_TYPE] == RPMRC_OK)
+    if (job->vd.type[RPMSIG_SIGNATURE_TYPE] == RPMRC_OK)
 	verified |= RPMSIG_SIGNATURE_TYPE;
-    if (vd.type[RPMSIG_DIGEST_TYPE] == RPMRC_OK)
+    if (job->vd.type[RPMSIG_DIGEST_TYPE] == RPMRC_OK)
 	verified |= RPMSIG_DIGEST_TYPE;
     rpmteSetVerified(p, verified);
 
-    if (prc) {
-	if (vd.msg == NULL)
-	    vd.msg = xstrdup(_("no verifiable digest or signature available"));
-	rpmteAddProblem(p, RPMPROB_VERIFY, NULL, vd.msg, 0);
+    if (job->prc) {
+	if (job->vd.msg == NULL)
+	    job->vd.msg = xstrdup(_("no verifiable digest or signature available"));
+	rpmteAddProblem(p, RPMPROB_VERIFY, NULL, job->vd.msg, 0);
+    }
+
+    job->vd.msg = _free(job->vd.msg);
+    job->auxh = headerFree(job->auxh);
+    job->vs = rpmvsFree(job->vs);
+    return job->prc;
+}
+
+/*
+ * Verify a batch of packages. Callbacks are issued from the main thread
+ * in transaction order with each package closed before the next one is
+ * opened, only the actual reading and verification of the packages runs
+ * in parallel.
+ */
+static void verifyPackages(rpmts ts, std::vector<struct vfyjob_s> & jobs,
+			   rpmVSFlags vsflags, rpmKeyring keyring,
+			   rpm_loff_t *ocp, rpm_loff_t total, int nthreads)
+{
+    int njobs = jobs.size();
+    int detach = (nthreads > 1 && njobs > 1);
+
+    for (auto & job : jobs) {
+	rpmtsNotify(ts, job.p, RPMCALLBACK_VERIFY_PROGRESS, (*ocp)++, total);
+	verifyPackageOpen(ts, &job, vsflags, keyring, detach);
     }
 
-    vd.msg = _free(vd.msg);
-    headerFree(auxh);
-    return prc;
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads) if (njobs > 1)
+    for (int i = 0; i < njobs; i++)
+	verifyPackageRead(ts, &jobs[i]);
+
+    for (auto & job : jobs)
+	verifyPackageClose(ts, &job);
+
+    jobs.clear();
 }
 
 static int verifyPackageFiles(rpmts ts, rpm_loff_t total)
@@ -1315,6 +1423,17 @@ static int verifyPackageFiles(rpmts ts, rpm_loff_t total)
     rpmte p;
     rpm_loff_t oc = 0;
     rpmVSFlags vsflags = rpmtsVfyFlags(ts);
+    int nthreads = 1;
+    size_t batchsize = 1;
+    std::vector<struct vfyjob_s> jobs;
+
+#ifdef ENABLE_OPENMP
+    nthreads = rpmExpandNumeric("%{?_pkgverify_nthreads}");
+    if (nthreads > 1)
+	batchsize = nthreads * 2;
+    else
+	nthreads = 1;
+#endif
 
     rpmtsNotify(ts, NULL, RPMCALLBACK_VERIFY_START, 0, total);
 
@@ -1322,12 +1441,14 @@ static int verifyPackageFiles(rpmts ts, rpm_loff_t total)
 
     pi = rpmtsiInit(ts);
     while ((p = rpmtsiNext(pi, TR_ADDED))) {
-	int vfylevel = rpmteVfyLevel(p);
-	struct rpmvs_s *vs = rpmvsCreate(vfylevel, vsflags, keyring);
-	rpmtsNotify(ts, p, RPMCALLBACK_VERIFY_PROGRESS, oc++, total);
-	verifyPackage(ts, p, vs, vfylevel);
-	rpmvsFree(vs);
+	struct vfyjob_s job = {};
+	job.p = p;
+	jobs.push_back(job);
+	/* Limit the number of simultaneously open packages */
+	if (jobs.size() >= batchsize)
+	    verifyPackages(ts, jobs, vsflags, keyring, &oc, total, nthreads);
     }
+    verifyPackages(ts, jobs, vsflags, keyring, &oc, total, nthreads);
     rpmtsNotify(ts, NULL, RPMCALLBACK_VERIFY_STOP, total, total);
 
     (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_VERIFY), 0);
@@ -1539,6 +1660,7 @@ static int rpmtsPrepare(rpmts ts)
     int rc = 0;
     uint64_t fileCount = countFiles(ts);
     const char *dbhome = NULL;
+    char *fpcfn = NULL;
     struct stat dbstat;
 
     fingerPrintCache fpc = fpCacheCreate(fileCount/2 + 10001, rpmtsPool(ts));
@@ -1564,7 +1686,17 @@ static int rpmtsPrepare(rpmts ts)
     rpmtsiFree(pi);
 
     /* Open rpmdb & enter chroot for fingerprinting if necessary */
-    if (rpmdbOpenAll(ts->rdb) || rpmChrootIn()) {
+    if (rpmdbOpenAll(ts->rdb)) {
+	rc = -1;
+	goto exit;
+    }
+
+    if (rpmExpandNumeric("%{?_fprint_cache}") > 0 && rpmdbHome(ts->rdb)) {
+	fpcfn = rstrscat(NULL, rpmdbHome(ts->rdb), "/.fpcache", NULL);
+	fpCacheLoad(fpc, fpcfn);
+    }
+
+    if (rpmChrootIn()) {
 	rc = -1;
 	goto exit;
     }
@@ -1616,6 +1748,9 @@ static int rpmtsPrepare(rpmts ts)
     if (rpmChrootOut())
 	rc = -1;
 
+    if (fpcfn)
+	fpCacheSave(fpc, fpcfn);
+
     /* On actual transaction, file info sets are not needed after this */
     if (!(rpmtsFlags(ts) & (RPMTRANS_FLAG_TEST|RPMTRANS_FLAG_BUILD_PROBS))) {
 	pi = rpmtsiInit(ts);
@@ -1630,32 +1765,117 @@ static int rpmtsPrepare(rpmts ts)
 
 exit:
     fpCacheFree(fpc);
+    free(fpcfn);
     return rc;
 }
 
 /*
  * Transaction main loop: install and remove packages
  */
+/*
+ * Can the element be installed by just laying down its payload, without
+ * running any scriptlets or triggers of its own or others?
+ */
+static int isUnpackOnly(rpmts ts, rpmte p,
+			const std::vector<std::string> & ftpfxs)
+{
+    int rc = 0;
+
+    if (rpmteType(p) != TR_ADDED || rpmteIsSource(p) || rpmteFailed(p))
+	goto exit;
+    if (rpmteHaveInstScripts(p))
+	goto exit;
+
+    /* Triggers in installed packages set off by this one */
+    {
+	rpmdbMatchIterator mi;
+	int triggered;
+
+	mi = rpmtsInitIterator(ts, RPMDBI_TRIGGERNAME, rpmteN(p), 0);
+	triggered = (rpmdbNextIterator(mi) != NULL);
+	rpmdbFreeIterator(mi);
+
+	if (triggered || rpmtriggersMatchPkgFiles(ts, p, ftpfxs))
+	    goto exit;
+    }
+    rc = 1;
+
+exit:
+    return rc;
+}
+
+static int reportFailed(rpmte p, int failed)
+{
+    if (failed) {
+	rpmlog(RPMLOG_ERR, "%s: %s %s\n", rpmteNEVRA(p),
+	       rpmteTypeString(p), failed > 1 ? _("skipped") : _("failed"));
+    }
+    return (failed != 0);
+}
+
+static int processInstalls(std::vector<rpmte> & batch, int nthreads, int *ip)
+{
+    int n = batch.size();
+    int rc = 0;
+
+    if (n > 1) {
+	std::vector<int> failed(n);
+	rpmteProcessInstalls(batch.data(), n, *ip, nthreads, failed.data());
+	for (int i = 0; i < n; i++)
+	    rc += reportFailed(batch[i], failed[i]);
+	*ip += n;
+    } else if (n == 1) {
+	rpmte p = batch[0];
+	rc += reportFailed(p, rpmteProcess(p, (pkgGoal)rpmteType(p), (*ip)++));
+    }
+    batch.clear();
+    return rc;
+}
+
 static int rpmtsProcess(rpmts ts)
 {
     rpmtsi pi;	rpmte p;
     int rc = 0;
     int i = 0;
+    int nthreads = 0;
+    std::vector<rpmte> batch;
+    std::vector<std::string> ftpfxs;	/* file trigger prefixes in rpmdb */
+    int ftvalid = 0;
+
+#ifdef ENABLE_OPENMP
+    /* Test transactions don't install anything, don't bother */
+    if (!(rpmtsFlags(ts) & RPMTRANS_FLAG_TEST))
+	nthreads = rpmExpandNumeric("%{?_install_nthreads}");
+#endif
 
     pi = rpmtsiInit(ts);
     while ((p = rpmtsiNext(pi, 0)) != NULL) {
-	int failed;
-
 	rpmlog(RPMLOG_DEBUG, "========== +++ %s %s-%s 0x%x\n",
 		rpmteNEVR(p), rpmteA(p), rpmteO(p), rpmteColor(p));
 
-	failed = rpmteProcess(p, (pkgGoal)rpmteType(p), i++);
-	if (failed) {
-	    rpmlog(RPMLOG_ERR, "%s: %s %s\n", rpmteNEVRA(p),
-		   rpmteTypeString(p), failed > 1 ? _("skipped") : _("failed"));
-	    rc++;
+	/* File triggers only change when a package with scripts goes in */
+	if (nthreads > 1 && !ftvalid) {
+	    ftpfxs = rpmtriggersFilePrefixes(ts);
+	    ftvalid = 1;
+	}
+
+	/* Collect consecutive unpack-only installs for parallel processing */
+	if (nthreads > 1 && isUnpackOnly(ts, p, ftpfxs)) {
+	    /* Files also created by an earlier element, start a new batch */
+	    if (rpmteOverlapped(p))
+		rc += processInstalls(batch, nthreads, &i);
+	    batch.push_back(p);
+	    if (batch.size() >= (size_t)nthreads * 4)
+		rc += processInstalls(batch, nthreads, &i);
+	    continue;
 	}
+
+	rc += processInstalls(batch, nthreads, &i);
+	rc += reportFailed(p, rpmteProcess(p, (pkgGoal)rpmteType(p), i++));
+	if (rpmteType(p) == TR_ADDED && rpmteHaveInstScripts(p))
+	    ftvalid = 0;
     }
+    rc += processInstalls(batch, nthreads, &i);
     rpmtsiFree(pi);
     return rc;
 }
@@ -1710,6 +1930,7 @@ rpmRC runScript(rpmts ts, rpmte te, Header h, ARGV_const_t prefixes,
 		       rpmScript script, int arg1, int arg2)
 {
     rpmte xte = te;
+    struct rpmop_s sop = {};
     rpmRC stoprc, rc = RPMRC_OK;
     rpmTagVal stag = rpmScriptTag(script);
     FD_t sfd = NULL;
@@ -1728,10 +1949,23 @@ rpmRC runScript(rpmts ts, rpmte te, Header h, ARGV_const_t prefixes,
     if (sfd == NULL)
 	sfd = rpmtsScriptFd(ts);
 
-    rpmswEnter(rpmtsOp(ts, RPMTS_OP_SCRIPTLETS), 0);
+    rpmswEnter(&sop, 0);
     rc = rpmScriptRun(script, arg1, arg2, sfd,
 		      prefixes, rpmtsPlugins(ts));
-    rpmswExit(rpmtsOp(ts, RPMTS_OP_SCRIPTLETS), 0);
+    rpmswExit(&sop, 0);
+    rpmswAdd(rpmtsOp(ts, RPMTS_OP_SCRIPTLETS), &sop);
+
+    /* Account the run to the element it was on behalf of, if any */
+    if (xte) {
+	int trig = (rpmScriptType(script) & (RPMSCRIPT_TRIGGERPREIN |
+		    RPMSCRIPT_TRIGGERIN | RPMSCRIPT_TRIGGERUN |
+		    RPMSCRIPT_TRIGGERPOSTUN));
+	rpmswAdd(rpmteOp(xte, trig ? RPMTE_OP_TRIGGERS : RPMTE_OP_SCRIPTLETS),
+		 &sop);
+	rpmteScriptTimings(xte).push_back({rpmScriptDescr(script), sop.usecs});
+    } else {
+	ts->scripttimes.push_back({rpmScriptDescr(script), sop.usecs});
+    }
 
     /* Map warn-only errors to "notfound" for script stop callback */
     stoprc = (rc != RPMRC_OK && warn_only) ? RPMRC_NOTFOUND : rc;
@@ -1758,25 +1992,45 @@ rpmRC runScript(rpmts ts, rpmte te, Header h, ARGV_const_t prefixes,
     return rc;
 }
 
-static void rpmtsSync(rpmts ts)
+void rpmtsSync(rpmts ts)
 {
-    if (rpmChrootDone())
-	return;
+    (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_SYNC), 0);
 
 #ifdef HAVE_SYNCFS
     for (auto & entry : ts->dsi) {
 	const diskspaceInfo *dsi = &entry.second;
-	int fd = open(dsi->mntPoint.c_str(), O_RDONLY);
-	if (fd != -1) {
+	if (dsi->syncfd >= 0) {
 	    rpmlog(RPMLOG_DEBUG, "syncing fs %s\n", dsi->mntPoint.c_str());
-	    syncfs(fd);
-	    close(fd);
+	    syncfs(dsi->syncfd);
 	}
     }
 #else
     rpmlog(RPMLOG_DEBUG, "syncing all filesystems\n");
     sync();
 #endif
+    (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_SYNC), 0);
+}
+
+/* Write the transaction profile to %_transaction_profile, if set */
+static void writeProfile(rpmts ts)
+{
+    char *fn = rpmExpand("%{?_transaction_profile}", NULL);
+
+    if (*fn) {
+	char *js = rpmtsProfile(ts);
+	FILE *f = fopen(fn, "w");
+	int rc = -1;
+	if (f) {
+	    rc = (fputs(js, f) < 0);
+	    rc |= fclose(f);
+	}
+	if (rc) {
+	    rpmlog(RPMLOG_WARNING, _("failed to write transaction profile %s: %s\n"),
+		    fn, strerror(errno));
+	}
+	free(js);
+    }
+    free(fn);
 }
 
 int rpmtsRun(rpmts ts, rpmps okProbs, rpmprobFilterFlags ignoreSet)
@@ -1917,6 +2171,8 @@ exit:
     }
     (void) umask(oldmask);
     (void) rpmtsFinish(ts);
+    if (nfailed >= 0)
+	writeProfile(ts);
     rpmpsFree(tsprobs);
     rpmtxnEnd(kxn);
     rpmtxnEnd(txn);
@@ -5,6 +5,7 @@
 
 #include "system.h"
 
+#include <string>
 #include <vector>
 
 #include <errno.h>
@@ -320,20 +321,30 @@ static const char * stateStr(rpmfileState fstate)
     return _("unknown state");
 }
 
+struct fileResult {
+    std::string fn;
+    rpmfileAttrs fileAttrs;
+    rpmVerifyAttrs verifyResult;
+    rpmfileState fstate;
+    int err;
+};
+
 /**
  * Check file info from header against what's actually installed.
+ * This only looks at the header and the filesystem, so it's safe to
+ * call for different headers from multiple threads.
  * @param ts		transaction set
  * @param h		header to verify
  * @param omitMask	bits to disable verify checks
  * @param incAttr	skip files without these attrs (eg %ghost)
  * @param skipAttr	skip files with these attrs (eg %ghost)
- * @return		0 no problems, 1 problems found
+ * @param[out] results	verify results of the checked files
+ * @return		0 on success, 1 if no file info
  */
-static int verifyHeader(rpmts ts, Header h, rpmVerifyAttrs omitMask,
-			rpmfileAttrs incAttrs, rpmfileAttrs skipAttrs)
+static int verifyFiles(rpmts ts, Header h, rpmVerifyAttrs omitMask,
+			rpmfileAttrs incAttrs, rpmfileAttrs skipAttrs,
+			std::vector<fileResult> & results)
 {
-    rpmVerifyAttrs verifyResult = 0;
-    rpmVerifyAttrs verifyAll = 0; /* assume no problems */
     rpmfi fi = rpmfiNew(ts, h, RPMTAG_BASENAMES, RPMFI_FLAGS_VERIFY);
 
     if (fi == NULL)
@@ -342,9 +353,6 @@ static int verifyHeader(rpmts ts, Header h, rpmVerifyAttrs omitMask,
     rpmfiInit(fi, 0);
     while (rpmfiNext(fi) >= 0) {
 	rpmfileAttrs fileAttrs = rpmfiFFlags(fi);
-	char *buf = NULL, *attrFormat;
-	const char *fstate = NULL;
-	char ac;
 
 	/* If filtering by inclusion, skip non-matching (eg --configfiles) */
 	if (incAttrs && !(incAttrs & fileAttrs))
@@ -354,12 +362,40 @@ static int verifyHeader(rpmts ts, Header h, rpmVerifyAttrs omitMask,
 	if (skipAttrs & fileAttrs)
 	    continue;
 
-	verifyResult = rpmfiVerify(fi, omitMask);
+	rpmVerifyAttrs verifyResult = rpmfiVerify(fi, omitMask);
+	int err = errno;
+
+	results.push_back({rpmfiFN(fi), fileAttrs, verifyResult,
+			   rpmfiFState(fi), err});
+    }
+    rpmfiFree(fi);
+
+    return 0;
+}
+
+/**
+ * Report file verify results.
+ * @param ts		transaction set
+ * @param h		header to verify
+ * @param results	verify results from verifyFiles()
+ * @return		0 no problems, 1 problems found
+ */
+static int reportFiles(rpmts ts, Header h, std::vector<fileResult> & results)
+{
+    rpmVerifyAttrs verifyAll = 0; /* assume no problems */
+
+    for (auto & res : results) {
+	rpmfileAttrs fileAttrs = res.fileAttrs;
+	rpmVerifyAttrs verifyResult = res.verifyResult;
+	const char *fn = res.fn.c_str();
+	char *buf = NULL, *attrFormat;
+	const char *fstate = NULL;
+	char ac;
 
 	/* Filter out timestamp differences of shared files */
 	if (verifyResult & RPMVERIFY_MTIME) {
 	    rpmdbMatchIterator mi;
-	    mi = rpmtsInitIterator(ts, RPMDBI_BASENAMES, rpmfiFN(fi), 0);
+	    mi = rpmtsInitIterator(ts, RPMDBI_BASENAMES, fn, 0);
 	    if (rpmdbGetIteratorCount(mi) > 1) 
 		verifyResult &= ~RPMVERIFY_MTIME;
 	    rpmdbFreeIterator(mi);
@@ -367,24 +403,24 @@ static int verifyHeader(rpmts ts, Header h, rpmVerifyAttrs omitMask,
 
 	/* State is only meaningful for installed packages */
 	if (headerGetInstance(h))
-	    fstate = stateStr(rpmfiFState(fi));
+	    fstate = stateStr(res.fstate);
 
 	attrFormat = rpmFFlagsString(fileAttrs);
 	ac = rstreq(attrFormat, "") ? ' ' : attrFormat[0];
 	if (verifyResult & RPMVERIFY_LSTATFAIL) {
 	    if (!(fileAttrs & (RPMFILE_MISSINGOK|RPMFILE_GHOST)) || rpmIsVerbose()) {
-		rasprintf(&buf, _("missing   %c %s"), ac, rpmfiFN(fi));
+		rasprintf(&buf, _("missing   %c %s"), ac, fn);
 		if ((verifyResult & RPMVERIFY_LSTATFAIL) != 0 &&
-		    errno != ENOENT) {
+		    res.err != ENOENT) {
 		    char *app;
-		    rasprintf(&app, " (%s)", strerror(errno));
+		    rasprintf(&app, " (%s)", strerror(res.err));
 		    rstrcat(&buf, app);
 		    free(app);
 		}
 	    }
 	} else if (verifyResult || fstate || rpmIsVerbose()) {
 	    char *verifyFormat = rpmVerifyString(verifyResult, ".");
-	    rasprintf(&buf, "%s  %c %s", verifyFormat, ac, rpmfiFN(fi));
+	    rasprintf(&buf, "%s  %c %s", verifyFormat, ac, fn);
 	    free(verifyFormat);
 	}
 	free(attrFormat);
@@ -402,11 +438,20 @@ static int verifyHeader(rpmts ts, Header h, rpmVerifyAttrs omitMask,
 
 	verifyAll |= verifyResult;
     }
-    rpmfiFree(fi);
 	
     return (verifyAll != 0) ? 1 : 0;
 }
 
+static int verifyHeader(rpmts ts, Header h, rpmVerifyAttrs omitMask,
+			rpmfileAttrs incAttrs, rpmfileAttrs skipAttrs)
+{
+    std::vector<fileResult> results;
+
+    if (verifyFiles(ts, h, omitMask, incAttrs, skipAttrs, results))
+	return 1;
+    return reportFiles(ts, h, results);
+}
+
 /**
  * Check installed package dependencies for problems.
  * @param ts		transaction set
@@ -468,6 +513,66 @@ int showVerifyPackage(QVA_t qva, rpmts ts, Header h)
     return ec;
 }
 
+struct verifyForeach_s {
+    QVA_t qva;
+    rpmts ts;
+};
+
+struct verifyResult_s {
+    int rc;
+    std::vector<fileResult> files;
+};
+
+/* File checks are the expensive part, do those in parallel */
+static int verifyForeachFunc(Header h, void *data, void **result)
+{
+    struct verifyForeach_s *vf = (struct verifyForeach_s *)data;
+    QVA_t qva = vf->qva;
+    struct verifyResult_s *res = new verifyResult_s {};
+
+    if (qva->qva_flags & VERIFY_FILES) {
+	res->rc = verifyFiles(vf->ts, h, qva->qva_ofvattr,
+			      qva->qva_incattr, qva->qva_excattr, res->files);
+    }
+    *result = res;
+    return 0;
+}
+
+/* Everything touching the transaction set and output happens in order */
+static int verifyForeachEmit(Header h, void *result, void *data)
+{
+    struct verifyForeach_s *vf = (struct verifyForeach_s *)data;
+    struct verifyResult_s *res = (struct verifyResult_s *)result;
+    QVA_t qva = vf->qva;
+    rpmts ts = vf->ts;
+    int ec = 0;
+    int rc;
+
+    if (qva->qva_flags & VERIFY_DEPS) {
+	if ((rc = verifyDependencies(ts, h)) != 0)
+	    ec = rc;
+    }
+    if (qva->qva_flags & VERIFY_FILES) {
+	if ((rc = (res->rc ? res->rc : reportFiles(ts, h, res->files))) != 0)
+	    ec = rc;
+    }
+    if (qva->qva_flags & VERIFY_SCRIPT) {
+	if ((rc = rpmVerifyScript(ts, h)) != 0)
+	    ec = rc;
+    }
+
+    delete res;
+    return ec;
+}
+
+int rpmcliVerifyForeach(QVA_t qva, rpmts ts, rpmdbMatchIterator mi,
+			int nthreads)
+{
+    struct verifyForeach_s vf = { qva, ts };
+    return rpmdbForeachIterator(mi, nthreads, verifyForeachFunc,
+				verifyForeachEmit, &vf);
+}
+
 int rpmcliVerify(rpmts ts, QVA_t qva, char * const * argv)
 {
     rpmVSFlags vsflags, ovsflags;
@@ -398,6 +398,18 @@ rpmts_VerifyDB(rpmtsObject * s)
     return Py_BuildValue("i", rc);
 }
 
+static PyObject *
+rpmts_CompactDB(rpmtsObject * s)
+{
+    int rc;
+
+    Py_BEGIN_ALLOW_THREADS
+    rc = rpmtsCompactDB(s->ts);
+    Py_END_ALLOW_THREADS
+
+    return Py_BuildValue("i", rc);
+}
+
 static PyObject *
 rpmts_dbCookie(rpmtsObject * s)
 {
@@ -413,6 +425,17 @@ rpmts_dbCookie(rpmtsObject * s)
     return ret;
 }
 
+static PyObject *
+rpmts_profile(rpmtsObject * s)
+{
+    PyObject *ret = NULL;
+    char *profile = rpmtsProfile(s->ts);
+
+    ret = utf8FromString(profile);
+    free(profile);
+    return ret;
+}
+
 static PyObject *
 rpmts_HdrFromFdno(rpmtsObject * s, PyObject *arg)
 {
@@ -857,6 +880,9 @@ Remove all elements from the transaction set\n" },
  {"verifyDB",	(PyCFunction) rpmts_VerifyDB,	METH_NOARGS,
 "ts.verifyDB() -> None\n\
 - Verify the default transaction rpmdb.\n" },
+ {"compactDB",	(PyCFunction) rpmts_CompactDB,	METH_NOARGS,
+"ts.compactDB() -> None\n\
+- Compact the default transaction rpmdb in place.\n" },
  {"hdrFromFdno",(PyCFunction) rpmts_HdrFromFdno,METH_O,
 "ts.hdrFromFdno(fdno) -> hdr\n\
 - Read a package header from a file descriptor.\n" },
@@ -883,6 +909,9 @@ Remove all elements from the transaction set\n" },
  {"dbCookie",	(PyCFunction) rpmts_dbCookie, 	METH_NOARGS,
 "dbCookie -> cookie\n\
 - Return a cookie string for determining if database has changed\n" },
+ {"profile",	(PyCFunction) rpmts_profile,	METH_NOARGS,
+"profile -> json\n\
+- Return a JSON formatted timing profile of the transaction set\n" },
     {NULL,		NULL}		/* sentinel */
 };
 
@@ -0,0 +1,403 @@
+/*
+ * Benchmark the rpmdb layer on reproducible synthetic databases.
+ *
+ * For every backend a scratch database is filled with generated package
+ * headers, then adding, iterating, looking up (by name, provide and file),
+ * rebuilding and removing are timed. Results are printed as one JSON
+ * object per line. The same options and seed always generate the same
+ * database. Read-only backends (bdb_ro) cannot be filled, for them the
+ * read operations are run against an existing database given with
+ * --ro-dbpath.
+ */
+#include <errno.h>
+#include <ftw.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <popt.h>
+#include <rpm/header.h>
+#include <rpm/rpmcli.h>
+#include <rpm/rpmdb.h>
+#include <rpm/rpmlog.h>
+#include <rpm/rpmmacro.h>
+#include <rpm/rpmstring.h>
+#include <rpm/rpmts.h>
+#include <rpm/rpmutil.h>
+
+static unsigned int npackages = 1000;
+static unsigned int nfiles = 50;
+static unsigned int nprovides = 10;
+static unsigned int nlookups = 1000;
+static unsigned int seed = 1;
+static char *backends = NULL;
+static char *workdir = NULL;
+static char *rodbpath = NULL;
+static int keep = 0;
+
+static struct poptOption benchOptsTable[] = {
+    { "packages", '\0', POPT_ARG_INT, &npackages, 0,
+	"number of packages to generate", "N" },
+    { "files", '\0', POPT_ARG_INT, &nfiles, 0,
+	"number of files per package", "N" },
+    { "provides", '\0', POPT_ARG_INT, &nprovides, 0,
+	"number of extra provides per package", "N" },
+    { "lookups", '\0', POPT_ARG_INT, &nlookups, 0,
+	"number of lookups per index", "N" },
+    { "seed", '\0', POPT_ARG_INT, &seed, 0,
+	"seed of the generated database", "N" },
+    { "backends", '\0', POPT_ARG_STRING, &backends, 0,
+	"comma separated list of backends (default: sqlite,ndb)", "LIST" },
+    { "workdir", '\0', POPT_ARG_STRING, &workdir, 0,
+	"directory for the scratch databases", "DIR" },
+    { "ro-dbpath", '\0', POPT_ARG_STRING, &rodbpath, 0,
+	"existing database for read-only backends", "DIR" },
+    { "keep", '\0', POPT_ARG_VAL, &keep, 1,
+	"keep the scratch databases", NULL },
+    POPT_TABLEEND
+};
+
+static struct poptOption optionsTable[] = {
+    { NULL, '\0', POPT_ARG_INCLUDE_TABLE, benchOptsTable, 0,
+	"Benchmark options:", NULL },
+    { NULL, '\0', POPT_ARG_INCLUDE_TABLE, rpmcliAllPoptTable, 0,
+	"Common options for all rpm modes and executables:", NULL },
+    POPT_AUTOHELP
+    POPT_TABLEEND
+};
+
+/* Keys sampled from the database for the lookup benchmarks */
+struct keys_s {
+    ARGV_t names;
+    ARGV_t provides;
+    ARGV_t files;
+};
+
+static uint32_t rnd(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *backend, const char *op, unsigned int count,
+		   double secs)
+{
+    printf("{\"backend\": \"%s\", \"op\": \"%s\", \"packages\": %u, "
+	   "\"files\": %u, \"provides\": %u, \"seed\": %u, \"count\": %u, "
+	   "\"seconds\": %.6f, \"ops_per_sec\": %.1f}\n",
+	   backend, op, npackages, nfiles, nprovides, seed, count, secs,
+	   secs > 0 ? count / secs : 0.0);
+    fflush(stdout);
+}
+
+static Header genHeader(unsigned int i, uint32_t *state)
+{
+    Header h = headerNew();
+    char name[32], version[32], buf[64];
+    const char *dirs[2];
+    char pkgdir[64];
+    char **bns = (char **)rcalloc(nfiles, sizeof(*bns));
+    uint32_t *dirindexes = (uint32_t *)rcalloc(nfiles, sizeof(*dirindexes));
+    uint32_t *sizes = (uint32_t *)rcalloc(nfiles, sizeof(*sizes));
+    uint16_t *modes = (uint16_t *)rcalloc(nfiles, sizeof(*modes));
+    char *states = (char *)rcalloc(nfiles, sizeof(*states));
+    uint32_t size = 0, flags;
+    unsigned int j;
+
+    snprintf(name, sizeof(name), "bench-%05u", i);
+    snprintf(version, sizeof(version), "%u.%u", i % 7 + 1, rnd(state) % 100);
+    headerPutString(h, RPMTAG_NAME, name);
+    headerPutString(h, RPMTAG_VERSION, version);
+    headerPutString(h, RPMTAG_RELEASE, "1");
+    headerPutString(h, RPMTAG_ARCH, "noarch");
+    headerPutString(h, RPMTAG_OS, "linux");
+    headerPutString(h, RPMTAG_SUMMARY, "Synthetic benchmark package");
+    headerPutString(h, RPMTAG_DESCRIPTION, "Synthetic benchmark package");
+    headerPutString(h, RPMTAG_LICENSE, "Public Domain");
+    headerPutString(h, RPMTAG_SOURCERPM, "bench-1-1.src.rpm");
+
+    /* self provide, then the extra ones */
+    snprintf(buf, sizeof(buf), "%s-1", version);
+    flags = RPMSENSE_EQUAL;
+    headerPutString(h, RPMTAG_PROVIDENAME, name);
+    headerPutString(h, RPMTAG_PROVIDEVERSION, buf);
+    headerPutUint32(h, RPMTAG_PROVIDEFLAGS, &flags, 1);
+    flags = 0;
+    for (j = 0; j < nprovides; j++) {
+	snprintf(buf, sizeof(buf), "bench(%05u.%u)", i, j);
+	headerPutString(h, RPMTAG_PROVIDENAME, buf);
+	headerPutString(h, RPMTAG_PROVIDEVERSION, "");
+	headerPutUint32(h, RPMTAG_PROVIDEFLAGS, &flags, 1);
+    }
+
+    /* require a few provides of earlier packages */
+    for (j = 0; i && nprovides && j < 3; j++) {
+	snprintf(buf, sizeof(buf), "bench(%05u.%u)",
+		 rnd(state) % i, rnd(state) % nprovides);
+	headerPutString(h, RPMTAG_REQUIRENAME, buf);
+	headerPutString(h, RPMTAG_REQUIREVERSION, "");
+	headerPutUint32(h, RPMTAG_REQUIREFLAGS, &flags, 1);
+    }
+
+    /* files in a private and a shared directory */
+    snprintf(pkgdir, sizeof(pkgdir), "/usr/share/bench/%05u/", i);
+    dirs[0] = pkgdir;
+    dirs[1] = "/usr/lib/bench/";
+    for (j = 0; j < nfiles; j++) {
+	dirindexes[j] = (j % 10 == 9);
+	rasprintf(&bns[j], dirindexes[j] ? "%05u-%u.so" : "file%u", i, j);
+	sizes[j] = rnd(state) % 65536;
+	modes[j] = 0100644;
+	size += sizes[j];
+    }
+    if (nfiles) {
+	headerPutStringArray(h, RPMTAG_BASENAMES, (const char **)bns, nfiles);
+	headerPutStringArray(h, RPMTAG_DIRNAMES, dirs, nfiles > 9 ? 2 : 1);
+	headerPutUint32(h, RPMTAG_DIRINDEXES, dirindexes, nfiles);
+	headerPutUint32(h, RPMTAG_FILESIZES, sizes, nfiles);
+	headerPutUint16(h, RPMTAG_FILEMODES, modes, nfiles);
+	headerPutChar(h, RPMTAG_FILESTATES, states, nfiles);
+    }
+    headerPutUint32(h, RPMTAG_SIZE, &size, 1);
+
+    for (j = 0; j < nfiles; j++)
+	free(bns[j]);
+    free(bns);
+    free(dirindexes);
+    free(sizes);
+    free(modes);
+    free(states);
+
+    /* rpmdb only accepts headers with an immutable region */
+    return headerReload(h, RPMTAG_HEADERIMMUTABLE);
+}
+
+static int benchAdd(rpmts ts, const char *backend)
+{
+    uint32_t state = seed ? seed : 1;
+    Header *hdrs = (Header *)rcalloc(npackages, sizeof(*hdrs));
+    rpmtxn txn;
+    double start;
+    unsigned int i;
+    int rc = 0;
+
+    for (i = 0; i < npackages; i++)
+	hdrs[i] = genHeader(i, &state);
+
+    txn = rpmtxnBegin(ts, RPMTXN_WRITE);
+    if (txn == NULL) {
+	rc = -1;
+	goto exit;
+    }
+    start = now();
+    for (i = 0; i < npackages && !rc; i++)
+	rc = (rpmtsImportHeader(txn, hdrs[i], 0) != RPMRC_OK);
+    report(backend, "add", i, now() - start);
+    rpmtxnEnd(txn);
+
+exit:
+    for (i = 0; i < npackages; i++)
+	headerFree(hdrs[i]);
+    free(hdrs);
+    return rc;
+}
+
+/* Full iteration, collecting the keys for the lookups on the way */
+static int benchIterate(rpmts ts, const char *backend, struct keys_s *keys)
+{
+    rpmdbMatchIterator mi;
+    Header h;
+    unsigned int n = 0;
+    double start = now();
+
+    mi = rpmtsInitIterator(ts, RPMDBI_PACKAGES, NULL, 0);
+    while ((h = rpmdbNextIterator(mi)) != NULL) {
+	struct rpmtd_s td;
+	const char *s;
+	n++;
+	argvAdd(&keys->names, headerGetString(h, RPMTAG_NAME));
+	if (headerGet(h, RPMTAG_PROVIDENAME, &td, HEADERGET_MINMEM)) {
+	    while ((s = rpmtdNextString(&td)) != NULL)
+		argvAdd(&keys->provides, s);
+	    rpmtdFreeData(&td);
+	}
+	if (headerGet(h, RPMTAG_FILENAMES, &td, HEADERGET_EXT)) {
+	    while ((s = rpmtdNextString(&td)) != NULL)
+		argvAdd(&keys->files, s);
+	    rpmtdFreeData(&td);
+	}
+    }
+    rpmdbFreeIterator(mi);
+    report(backend, "iterate", n, now() - start);
+    return 0;
+}
+
+static int benchLookup(rpmts ts, const char *backend, const char *op,
+		       rpmDbiTagVal tag, ARGV_const_t keys)
+{
+    uint32_t state = seed ? seed : 1;
+    unsigned int i, nkeys = argvCount(keys);
+    int rc = 0;
+    double start;
+
+    if (nkeys == 0)
+	return 0;
+    start = now();
+    for (i = 0; i < nlookups; i++) {
+	const char *key = keys[rnd(&state) % nkeys];
+	rpmdbMatchIterator mi = rpmtsInitIterator(ts, tag, key, 0);
+	if (rpmdbGetIteratorCount(mi) == 0)
+	    rc = 1;
+	while (rpmdbNextIterator(mi) != NULL)
+	    ;
+	rpmdbFreeIterator(mi);
+    }
+    report(backend, op, nlookups, now() - start);
+    return rc;
+}
+
+static int benchRebuild(rpmts ts, const char *backend)
+{
+    double start;
+    int rc;
+
+    rpmtsCloseDB(ts);
+    start = now();
+    rc = rpmtsRebuildDB(ts);
+    report(backend, "rebuild", npackages, now() - start);
+    return rc;
+}
+
+/* Remove every other package in a database-only transaction */
+static int benchRemove(rpmts ts, const char *backend)
+{
+    rpmdbMatchIterator mi;
+    Header h;
+    unsigned int n = 0;
+    double start;
+    int rc;
+
+    mi = rpmtsInitIterator(ts, RPMDBI_PACKAGES, NULL, 0);
+    while ((h = rpmdbNextIterator(mi)) != NULL) {
+	if (n++ % 2 == 0)
+	    rpmtsAddEraseElement(ts, h, rpmdbGetIteratorOffset(mi));
+    }
+    rpmdbFreeIterator(mi);
+
+    rpmtsSetFlags(ts, RPMTRANS_FLAG_JUSTDB | RPMTRANS_FLAG_NOSCRIPTS |
+		      RPMTRANS_FLAG_NOTRIGGERS);
+    rpmtsOrder(ts);
+    start = now();
+    rc = rpmtsRun(ts, NULL, RPMPROB_FILTER_DISKSPACE);
+    report(backend, "remove", rpmtsNElements(ts), now() - start);
+    rpmtsEmpty(ts);
+    return rc;
+}
+
+static int rmentry(const char *fpath, const struct stat *sb, int typeflag,
+		   struct FTW *ftwbuf)
+{
+    return remove(fpath);
+}
+
+static int runBackend(const char *backend)
+{
+    struct keys_s keys = { NULL, NULL, NULL };
+    char *dbpath = NULL;
+    rpmts ts = NULL;
+    int ro = rstreq(backend, "bdb_ro");
+    int rc = 0;
+
+    if (ro) {
+	if (rodbpath == NULL) {
+	    fprintf(stderr, "%s: skipped, needs --ro-dbpath\n", backend);
+	    return 0;
+	}
+	dbpath = rstrdup(rodbpath);
+    } else {
+	dbpath = rstrscat(NULL, workdir, "/", backend, NULL);
+    }
+
+    rpmPushMacro(NULL, "_db_backend", NULL, backend, RMIL_CMDLINE);
+    rpmPushMacro(NULL, "_dbpath", NULL, dbpath, RMIL_CMDLINE);
+
+    ts = rpmtsCreate();
+    rpmtsSetRootDir(ts, rpmcliRootDir);
+
+    if (!ro && (rc = benchAdd(ts, backend)))
+	goto exit;
+
+    rc += benchIterate(ts, backend, &keys);
+    rc += benchLookup(ts, backend, "lookup-name", RPMDBI_NAME, keys.names);
+    rc += benchLookup(ts, backend, "lookup-provide", RPMDBI_PROVIDENAME,
+		      keys.provides);
+    rc += benchLookup(ts, backend, "lookup-file", RPMDBI_INSTFILENAMES,
+		      keys.files);
+
+    if (!ro) {
+	rc += benchRebuild(ts, backend);
+	rc += benchRemove(ts, backend);
+    }
+
+exit:
+    if (rc)
+	fprintf(stderr, "%s: benchmark failed\n", backend);
+    rpmtsFree(ts);
+    rpmPopMacro(NULL, "_dbpath");
+    rpmPopMacro(NULL, "_db_backend");
+    argvFree(keys.names);
+    argvFree(keys.provides);
+    argvFree(keys.files);
+    free(dbpath);
+    return rc;
+}
+
+int main(int argc, char *argv[])
+{
+    poptContext optCon = rpmcliInit(argc, argv, optionsTable);
+    ARGV_t blist = NULL;
+    int created = 0;
+    int ec = EXIT_FAILURE;
+
+    if (optCon == NULL || poptPeekArg(optCon)) {
+	poptPrintUsage(optCon, stderr, 0);
+	goto exit;
+    }
+
+    if (workdir == NULL) {
+	workdir = rstrdup("/tmp/rpmdbbench.XXXXXX");
+	if (mkdtemp(workdir) == NULL) {
+	    fprintf(stderr, "mkdtemp: %s\n", strerror(errno));
+	    goto exit;
+	}
+	created = 1;
+    }
+
+    argvSplit(&blist, backends ? backends : "sqlite,ndb", ",");
+    ec = EXIT_SUCCESS;
+    for (ARGV_const_t b = blist; b && *b; b++) {
+	if (runBackend(*b))
+	    ec = EXIT_FAILURE;
+    }
+
+    if (created && !keep)
+	nftw(workdir, rmentry, 16, FTW_DEPTH | FTW_PHYS);
+
+exit:
+    argvFree(blist);
+    rpmcliFini(optCon);
+    return ec;
+}
@@ -14,6 +14,7 @@ enum modes {
     MODE_IMPORTDB	= (1 << 4),
     MODE_SALVAGEDB	= (1 << 5),
     MODE_PARKDB		= (1 << 6),
+    MODE_COMPACTDB	= (1 << 7),
 };
 
 static int mode = 0;
@@ -24,6 +25,8 @@ static struct poptOption dbOptsTable[] = {
     { "rebuilddb", '\0', (POPT_ARG_VAL|POPT_ARGFLAG_OR), &mode, MODE_REBUILDDB,
 	N_("rebuild database inverted lists from installed package headers"),
 	NULL},
+    { "compactdb", '\0', (POPT_ARG_VAL|POPT_ARGFLAG_OR),
+	&mode, MODE_COMPACTDB, N_("compact database in place"), NULL},
     { "parkdb", '\0', (POPT_ARG_VAL|POPT_ARGFLAG_OR),
 	&mode, MODE_PARKDB, N_("park database"), NULL},
     { "verifydb", '\0', (POPT_ARG_VAL|POPT_ARGFLAG_OR),
@@ -121,6 +124,9 @@ int main(int argc, char *argv[])
 	ec = rpmtsRebuildDB(ts);
 	rpmtsSetVSFlags(ts, ovsflags);
     }	break;
+    case MODE_COMPACTDB:
+	ec = rpmtsCompactDB(ts);
+	break;
     case MODE_PARKDB:
 	ec = rpmtsParkDB(ts);
 	break;